@@ -0,0 +1,135 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2011, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "driver_api.h"
+#include "stui_config.h"
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+/** Registered drivers.  The first is the default. **/
+static const struct drv_ops *drivers[STUI_MAX_DRIVERS] = { &xterm_driver, 
+                                                            &memory_driver,
+                                                            &record_driver };
+static unsigned int n_drivers = 3;
+
+/*****************************************************************************/
+/* Public functions.  Defined in header file.                                */
+/*****************************************************************************/
+
+/**
+    Register a driver, so it can be found by name.  A driver with the same
+    name as one already registered replaces it.  Drivers should be registered
+    before any contexts are opened.  A driver is refused if it is missing
+    any of the operations its capabilities call for.
+    
+    @param ops       Driver's table of operations.
+    
+    @return 0 if successful, -1 if failure.
+**/
+extern int drv_register( const struct drv_ops *ops )
+{
+    unsigned int i;
+    
+    if ( !ops || !ops->name || !ops->open || !ops->get_screen_size
+        || !ops->put_screen || !ops->close )
+        return -1;
+    
+    if ( ( ( ops->caps & DRV_CAP_DIFF ) && !ops->put_runs )
+        || ( ( ops->caps & DRV_CAP_SCROLL ) && !ops->scroll )
+        || ( ( ops->caps & DRV_CAP_SYNC ) 
+             && ( !ops->begin_frame || !ops->end_frame ) ) )
+        return -1;
+    
+    for ( i = 0; i < n_drivers; i++ )
+    {
+        if ( !strcmp( drivers[i]->name, ops->name ) )
+        {
+            drivers[i] = ops;
+            return 0;
+        }
+    }
+    
+    if ( n_drivers == STUI_MAX_DRIVERS )
+        return -1;
+    
+    drivers[n_drivers++] = ops;
+    return 0;
+}
+
+/**
+    Find a registered driver.
+    
+    @param name      Name of the driver, or NULL for the default driver.
+    
+    @return Driver's table of operations, or NULL if not found.
+**/
+extern const struct drv_ops * drv_find( const char *name )
+{
+    unsigned int i;
+    
+    if ( !name )
+        return drivers[0];
+    
+    for ( i = 0; i < n_drivers; i++ )
+        if ( !strcmp( drivers[i]->name, name ) )
+            return drivers[i];
+    
+    return NULL;
+}
+
+/**
+    Get a registered driver by its position in the registry, for listing
+    them all.
+    
+    @param i         Position, starting from 0 for the default driver.
+    
+    @return Driver's table of operations, or NULL if there are fewer drivers.
+**/
+extern const struct drv_ops * drv_get( unsigned int i )
+{
+    return ( i < n_drivers ) ? drivers[i] : NULL;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
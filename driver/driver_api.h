@@ -34,12 +34,96 @@
 
 #include "stui.h"
 
-/* Device drivers are required to implement the following API */
+/**
+   A run of consecutive cells on one row of the screen that have changed since
+   the last frame was presented.
+**/
+struct drv_run {
+    unsigned int row, col;
+    unsigned int len;
+};
 
-extern int  drv_open( void );
-extern void drv_get_screen_size( unsigned int *, unsigned int * );
-extern void drv_put_screen( STUI_CHAR_T * );
-extern void drv_close( void );
+/**
+   Each open terminal is an instance of the driver, managed by an opaque
+   handle.
+**/
+typedef void * DRV_T;
+
+/**
+   Function called by the driver when the size of any of its screens may have
+   changed.  It can be called from a signal handler or interrupt, so must only
+   do things that are safe there.
+**/
+typedef void (*DRV_RESIZE_HOOK_T)( void );
+
+/**
+   Capabilities of a driver, which the server uses to choose how to present
+   each frame.
+   
+     DRV_CAP_DIFF    Only the changed cells need to be sent, with put_runs.
+                     Otherwise the whole screen is sent with put_screen.
+     DRV_CAP_SCROLL  Bands of rows can be scrolled, so the server looks for
+                     rows that have moved and scrolls them rather than
+                     sending them again.
+     DRV_CAP_SYNC    Output can be bracketed by begin_frame and end_frame so
+                     that the terminal shows the frame all at once.
+**/
+#define DRV_CAP_DIFF        ( 1 << 0 )
+#define DRV_CAP_SCROLL      ( 1 << 1 )
+#define DRV_CAP_SYNC        ( 1 << 2 )
+
+/**
+   Device drivers are described by a table of operations, registered with
+   drv_register().  Operations a driver does not have can be NULL, apart from
+   open, get_screen_size, put_screen and close, and those its capabilities
+   call for.  New operations are added at the end, so that older tables
+   remain valid.
+**/
+struct drv_ops {
+    const char *name;
+    unsigned int caps;
+    
+    /* Open a device, returning a handle or NULL if failed */
+    DRV_T (*open)( const char * /* device */ );
+    
+    /* Read the current size of the screen */
+    void (*get_screen_size)( DRV_T, unsigned int * /* rows */, 
+                                    unsigned int * /* cols */ );
+    
+    /* Set the function called when any of the driver's screens resizes */
+    void (*set_resize_hook)( DRV_RESIZE_HOOK_T );
+    
+    /* Present the complete screen */
+    void (*put_screen)( DRV_T, STUI_CHAR_T * /* vbuf */ );
+    
+    /* Present the changed runs of cells (DRV_CAP_DIFF) */
+    void (*put_runs)( DRV_T, STUI_CHAR_T * /* vbuf */, 
+                      const struct drv_run *, unsigned int );
+    
+    /* Scroll rows top to bottom-1 by n, up if positive (DRV_CAP_SCROLL) */
+    void (*scroll)( DRV_T, unsigned int /* top */, unsigned int /* bottom */, 
+                    int /* n */ );
+    
+    /* Bracket the output for one frame (DRV_CAP_SYNC) */
+    void (*begin_frame)( DRV_T );
+    void (*end_frame)( DRV_T );
+    
+    /* Close the device */
+    void (*close)( DRV_T );
+    
+    /* Total number of bytes sent to the terminal so far, for statistics */
+    unsigned long (*get_bytes)( DRV_T );
+};
+
+/* Drivers built into the library */
+extern const struct drv_ops xterm_driver;
+extern const struct drv_ops memory_driver;
+extern const struct drv_ops record_driver;
+
+/* Driver registry */
+extern int drv_register( const struct drv_ops * );
+extern const struct drv_ops * drv_find( const char * );
+extern const struct drv_ops * drv_get( unsigned int );
 
 #endif /* DRIVER_API_H */
 
@@ -0,0 +1,519 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2011, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "driver_api.h"
+#include "memory_driver.h"
+#include "xterm_enc.h"
+#include "osal/osal.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+#define DEFAULT_ROWS        ( 24 )
+#define DEFAULT_COLS        ( 80 )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   A screen in memory.  The lock keeps the accessors, which may be called from
+   any task, in step with the server presenting frames.
+**/
+struct memscreen {
+    osal_mutex_t lock;
+    
+    /* Released for every frame, for memdrv_wait_frames() */
+    osal_sem_t frame_sem;
+    
+    unsigned int rows, cols;
+    STUI_CHAR_T *cells;
+    unsigned long frames;
+    
+    /* Set when the screen has been resized and the server has not yet read
+       the new size, so frames are still for the old size */
+    int stale;
+    
+    /* Encoder, when the output is wanted */
+    int encode;
+    struct xterm_enc enc;
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+/** Called when memdrv_resize() changes the size of a screen **/
+static DRV_RESIZE_HOOK_T resize_hook = NULL;
+
+/*****************************************************************************/
+/* Private function prototypes.  Declare as static.                          */
+/*****************************************************************************/
+
+static DRV_T mem_open( const char * );
+static void mem_get_screen_size( DRV_T, unsigned int *, unsigned int * );
+static void mem_set_resize_hook( DRV_RESIZE_HOOK_T );
+static void mem_put_screen( DRV_T, STUI_CHAR_T * );
+static void mem_put_runs( DRV_T, STUI_CHAR_T *, const struct drv_run *, unsigned int );
+static void mem_scroll( DRV_T, unsigned int, unsigned int, int );
+static void mem_close( DRV_T );
+
+/*****************************************************************************/
+/* Public Data.                                                              */
+/*****************************************************************************/
+
+/**
+   The memory driver.
+**/
+const struct drv_ops memory_driver = {
+    "memory",
+    DRV_CAP_DIFF | DRV_CAP_SCROLL,
+    mem_open,
+    mem_get_screen_size,
+    mem_set_resize_hook,
+    mem_put_screen,
+    mem_put_runs,
+    mem_scroll,
+    NULL,
+    NULL,
+    mem_close,
+    memdrv_get_bytes
+};
+
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/**
+    Open a screen in memory.
+    
+    @param device    Size and options, as "COLSxROWS[:xterm]", or NULL for an
+                     80x24 screen.
+    
+    @return Driver handle if successful, NULL if failed.
+**/
+static DRV_T mem_open( const char *device )
+{
+    struct memscreen *ms;
+    unsigned int rows = DEFAULT_ROWS, cols = DEFAULT_COLS;
+    unsigned int i;
+    
+    if ( device && *device && *device != ':' )
+    {
+        if ( 2 != sscanf( device, "%ux%u", &cols, &rows ) || !rows || !cols )
+            return NULL;
+    }
+    
+    ms = calloc( 1, sizeof(*ms) );
+    if ( !ms )
+        return NULL;
+    
+    ms->rows  = rows;
+    ms->cols  = cols;
+    ms->cells = malloc( rows * cols * sizeof(STUI_CHAR_T) );
+    if ( !ms->cells )
+    {
+        free( ms );
+        return NULL;
+    }
+    
+    for ( i = 0; i < rows * cols; i++ )
+        ms->cells[i] = ' ';
+    
+    if ( xenc_init( &ms->enc, NULL, NULL ) )
+    {
+        free( ms->cells );
+        free( ms );
+        return NULL;
+    }
+    xenc_set_size( &ms->enc, rows, cols );
+    
+    if ( osal_mutex_init( &ms->lock, "stui:memdrv" ) )
+    {
+        xenc_free( &ms->enc );
+        free( ms->cells );
+        free( ms );
+        return NULL;
+    }
+    
+    if ( osal_sem_init( &ms->frame_sem, 0, "stui:memframe" ) )
+    {
+        osal_mutex_destroy( &ms->lock );
+        xenc_free( &ms->enc );
+        free( ms->cells );
+        free( ms );
+        return NULL;
+    }
+    
+    ms->encode = device && strstr( device, ":xterm" );
+    
+    return (DRV_T)ms;
+}
+
+static void mem_get_screen_size( DRV_T drv, unsigned int *prows, unsigned int *pcols )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    
+    if ( !osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        /* From now on frames are for the current size */
+        ms->stale = 0;
+        xenc_set_size( &ms->enc, ms->rows, ms->cols );
+        
+        if ( prows ) *prows = ms->rows;
+        if ( pcols ) *pcols = ms->cols;
+        osal_mutex_release( &ms->lock );
+    }
+}
+
+/**
+    Register the function to call when a screen is resized.
+    
+    @param hook      Function to call, or NULL for none.
+**/
+static void mem_set_resize_hook( DRV_RESIZE_HOOK_T hook )
+{
+    resize_hook = hook;
+}
+
+/**
+    Present a complete screen.
+    
+    @param drv       Driver handle.
+    @param vbuf      Visual buffer holding the complete new screen.
+**/
+static void mem_put_screen( DRV_T drv, STUI_CHAR_T *vbuf )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    
+    if ( osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    if ( ms->stale )
+    {
+        osal_mutex_release( &ms->lock );
+        return;
+    }
+    
+    memcpy( ms->cells, vbuf, ms->rows * ms->cols * sizeof(STUI_CHAR_T) );
+    ms->frames++;
+    
+    if ( ms->encode )
+    {
+        xenc_put_screen( &ms->enc, vbuf );
+        xenc_flush( &ms->enc );
+    }
+    
+    osal_mutex_release( &ms->lock );
+    osal_sem_release( &ms->frame_sem );
+}
+
+/**
+    Present the changed cells of the screen.
+    
+    @param drv       Driver handle.
+    @param vbuf      Visual buffer holding the complete new screen.
+    @param runs      Array of runs of changed cells.
+    @param n         Number of runs.
+**/
+static void mem_put_runs( DRV_T drv, STUI_CHAR_T *vbuf, 
+                          const struct drv_run *runs, unsigned int n )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    unsigned int i, pos;
+    
+    if ( osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    if ( ms->stale )
+    {
+        osal_mutex_release( &ms->lock );
+        return;
+    }
+    
+    for ( i = 0; i < n; i++ )
+    {
+        pos = runs[i].row * ms->cols + runs[i].col;
+        memcpy( ms->cells + pos, vbuf + pos, runs[i].len * sizeof(STUI_CHAR_T) );
+    }
+    ms->frames++;
+    
+    if ( ms->encode )
+    {
+        xenc_put_runs( &ms->enc, vbuf, runs, n );
+        xenc_flush( &ms->enc );
+    }
+    
+    osal_mutex_release( &ms->lock );
+    osal_sem_release( &ms->frame_sem );
+}
+
+/**
+    Scroll a band of rows of the screen.  The rows scrolled in are blank.
+    
+    @param drv       Driver handle.
+    @param top       First row of the band.
+    @param bottom    Row after the last row of the band.
+    @param n         Rows to scroll by, positive for up, negative for down.
+**/
+static void mem_scroll( DRV_T drv, unsigned int top, unsigned int bottom, int n )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    unsigned int rows, i;
+    STUI_CHAR_T *blank;
+    
+    if ( osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    rows = ( n < 0 ) ? (unsigned int)-n : (unsigned int)n;
+    if ( !ms->stale && rows < bottom - top )
+    {
+        if ( n > 0 )
+        {
+            memmove( ms->cells + top * ms->cols, 
+                     ms->cells + ( top + rows ) * ms->cols,
+                     ( bottom - top - rows ) * ms->cols * sizeof(STUI_CHAR_T) );
+            blank = ms->cells + ( bottom - rows ) * ms->cols;
+        }
+        else
+        {
+            memmove( ms->cells + ( top + rows ) * ms->cols, 
+                     ms->cells + top * ms->cols,
+                     ( bottom - top - rows ) * ms->cols * sizeof(STUI_CHAR_T) );
+            blank = ms->cells + top * ms->cols;
+        }
+        
+        for ( i = 0; i < rows * ms->cols; i++ )
+            blank[i] = ' ';
+        
+        if ( ms->encode )
+            xenc_scroll( &ms->enc, top, bottom, n );
+    }
+    
+    osal_mutex_release( &ms->lock );
+}
+
+static void mem_close( DRV_T drv )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    
+    osal_sem_destroy( &ms->frame_sem );
+    osal_mutex_destroy( &ms->lock );
+    xenc_free( &ms->enc );
+    free( ms->cells );
+    free( ms );
+}
+
+/*****************************************************************************/
+/* Public functions.  Defined in header file.                                */
+/*****************************************************************************/
+
+/**
+    Get the number of frames presented to a memory screen.
+    
+    @param drv       Driver handle.
+    
+    @return Number of frames.
+**/
+extern unsigned long memdrv_get_frames( DRV_T drv )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    unsigned long frames = 0;
+    
+    if ( !osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        frames = ms->frames;
+        osal_mutex_release( &ms->lock );
+    }
+    
+    return frames;
+}
+
+/**
+    Wait until a number of frames have been presented to a memory screen.
+    
+    @param drv       Driver handle.
+    @param frames    Frame count to wait for.
+    @param ms        Longest time to wait between frames, in milliseconds.
+    
+    @return Number of frames presented, which is less than frames if the
+            wait timed out.
+**/
+extern unsigned long memdrv_wait_frames( DRV_T drv, unsigned long frames, 
+                                         unsigned int ms )
+{
+    struct memscreen *sc = (struct memscreen *)drv;
+    
+    while ( memdrv_get_frames( drv ) < frames )
+        if ( osal_sem_obtain( &sc->frame_sem, (OSAL_SUSPEND)ms ) )
+            break;
+    
+    return memdrv_get_frames( drv );
+}
+
+/**
+    Get the number of bytes the xterm encoder has produced for a memory
+    screen.  This is 0 unless the encoder is in use.
+    
+    @param drv       Driver handle.
+    
+    @return Number of bytes.
+**/
+extern unsigned long memdrv_get_bytes( DRV_T drv )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    unsigned long bytes = 0;
+    
+    if ( !osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        bytes = ms->enc.bytes;
+        osal_mutex_release( &ms->lock );
+    }
+    
+    return bytes;
+}
+
+/**
+    Take a copy of a memory screen.  To find the size of buffer needed, call
+    with a NULL buffer first.
+    
+    @param drv       Driver handle.
+    @param buf       Buffer for rows * cols cells, or NULL.
+    @param p_rows    Pointer to store the number of rows.  Can be NULL.
+    @param p_cols    Pointer to store the number of columns.  Can be NULL.
+    
+    @return Number of frames presented to the screen so far, so the caller
+            can tell which frame it has a copy of.
+**/
+extern unsigned long memdrv_get_screen( DRV_T drv, STUI_CHAR_T *buf,
+                                        unsigned int *p_rows, 
+                                        unsigned int *p_cols )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    unsigned long frames = 0;
+    
+    if ( !osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        if ( buf )
+            memcpy( buf, ms->cells, ms->rows * ms->cols * sizeof(STUI_CHAR_T) );
+        if ( p_rows ) *p_rows = ms->rows;
+        if ( p_cols ) *p_cols = ms->cols;
+        frames = ms->frames;
+        osal_mutex_release( &ms->lock );
+    }
+    
+    return frames;
+}
+
+/**
+    Run the frames for a memory screen through the xterm encoder, sending the
+    output to a sink.  The encoder starts from an unknown terminal state, as
+    if the terminal had just been attached.
+    
+    @param drv       Driver handle.
+    @param sink      Function given the encoder's output, or NULL to throw
+                     it away.
+    @param arg       Argument for the sink.
+**/
+extern void memdrv_set_sink( DRV_T drv, XENC_SINK_T sink, void *arg )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    
+    if ( !osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        ms->enc.sink     = sink;
+        ms->enc.sink_arg = arg;
+        ms->encode       = 1;
+        xenc_invalidate( &ms->enc );
+        osal_mutex_release( &ms->lock );
+    }
+}
+
+/**
+    Change the size of a memory screen, as if the terminal had been resized.
+    The contents are cleared, and the server told of the change.  Frames for
+    the old size, presented before the server has caught up, are dropped.
+    
+    @param drv       Driver handle.
+    @param rows      New number of rows.
+    @param cols      New number of columns.
+**/
+extern void memdrv_resize( DRV_T drv, unsigned int rows, unsigned int cols )
+{
+    struct memscreen *ms = (struct memscreen *)drv;
+    STUI_CHAR_T *cells;
+    unsigned int i;
+    
+    if ( !rows || !cols )
+        return;
+    
+    cells = malloc( rows * cols * sizeof(STUI_CHAR_T) );
+    if ( !cells )
+        return;
+    
+    for ( i = 0; i < rows * cols; i++ )
+        cells[i] = ' ';
+    
+    if ( osal_mutex_obtain( &ms->lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        free( cells );
+        return;
+    }
+    
+    free( ms->cells );
+    ms->cells = cells;
+    ms->rows  = rows;
+    ms->cols  = cols;
+    ms->stale = 1;
+    xenc_invalidate( &ms->enc );
+    osal_mutex_release( &ms->lock );
+    
+    if ( resize_hook )
+        resize_hook();
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
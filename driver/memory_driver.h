@@ -0,0 +1,64 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+#ifndef MEMORY_DRIVER_H
+#define MEMORY_DRIVER_H
+
+#include "driver_api.h"
+#include "xterm_enc.h"
+
+/**
+   The memory driver presents frames into a grid of cells in memory rather
+   than a terminal, for benchmarks and tests that run without one.  It is
+   registered as "memory", and the device names the size of the screen as
+   "COLSxROWS", 80x24 if not given.  Adding ":xterm", as in "132x50:xterm",
+   also runs every frame through the xterm encoder and throws the output
+   away, counting the bytes.
+   
+   The handle for the accessors is found with stui_context_get_driver().  They
+   may be called from any task while the server is running.  They must not be
+   given the handle of a context using the "record" driver, even if it is
+   recording onto the memory driver; use rec_get_driver() to find the memory
+   driver's handle instead.
+**/
+
+extern unsigned long memdrv_get_frames( DRV_T );
+extern unsigned long memdrv_wait_frames( DRV_T, unsigned long, unsigned int );
+extern unsigned long memdrv_get_bytes( DRV_T );
+extern unsigned long memdrv_get_screen( DRV_T, STUI_CHAR_T *, unsigned int *, unsigned int * );
+extern void memdrv_set_sink( DRV_T, XENC_SINK_T, void * );
+extern void memdrv_resize( DRV_T, unsigned int, unsigned int );
+
+#endif /* MEMORY_DRIVER_H */
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
@@ -0,0 +1,388 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2011, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "driver_api.h"
+#include "record.h"
+#include "osal/osal.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+/* Longest device string for the driver being recorded */
+#define MAX_DEVICE      ( 256 )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   A recording, and the driver it passes the frames on to.
+**/
+struct recorder {
+    FILE *fp;
+    
+    const struct drv_ops *ops;
+    DRV_T drv;
+    
+    /* Size of the screen last recorded */
+    unsigned int rows, cols;
+    
+    /* Time of the last frame, in microseconds */
+    unsigned int last_time;
+    
+    /* Set when the frame being built has scrolled */
+    int scrolled;
+};
+
+/*****************************************************************************/
+/* Private function prototypes.  Declare as static.                          */
+/*****************************************************************************/
+
+static DRV_T rec_open( const char * );
+static void rec_get_screen_size( DRV_T, unsigned int *, unsigned int * );
+static void rec_set_resize_hook( DRV_RESIZE_HOOK_T );
+static void rec_put_screen( DRV_T, STUI_CHAR_T * );
+static void rec_put_runs( DRV_T, STUI_CHAR_T *, const struct drv_run *, unsigned int );
+static void rec_scroll( DRV_T, unsigned int, unsigned int, int );
+static void rec_begin_frame( DRV_T );
+static void rec_end_frame( DRV_T );
+static void rec_close( DRV_T );
+static unsigned long rec_get_bytes( DRV_T );
+
+/*****************************************************************************/
+/* Public Data.                                                              */
+/*****************************************************************************/
+
+/**
+   The recording driver.  It offers everything to the server, and makes up
+   for anything the driver being recorded does not have.
+**/
+const struct drv_ops record_driver = {
+    "record",
+    DRV_CAP_DIFF | DRV_CAP_SCROLL | DRV_CAP_SYNC,
+    rec_open,
+    rec_get_screen_size,
+    rec_set_resize_hook,
+    rec_put_screen,
+    rec_put_runs,
+    rec_scroll,
+    rec_begin_frame,
+    rec_end_frame,
+    rec_close,
+    rec_get_bytes
+};
+
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/** Write an unsigned number as LEB128 **/
+static void put_uint( FILE *fp, unsigned long v )
+{
+    while ( v >= 0x80 )
+    {
+        putc( (int)( v & 0x7F ) | 0x80, fp );
+        v >>= 7;
+    }
+    putc( (int)v, fp );
+}
+
+/** Write a signed number, zigzag encoded **/
+static void put_int( FILE *fp, int v )
+{
+    put_uint( fp, v < 0 ? ( (unsigned long)-(long)v * 2 ) - 1 
+                        : (unsigned long)v * 2 );
+}
+
+/** Write cells, low byte first **/
+static void put_cells( FILE *fp, const STUI_CHAR_T *cells, unsigned int n )
+{
+    while ( n-- )
+    {
+        putc( *cells & 0xFF, fp );
+        putc( ( *cells++ >> 8 ) & 0xFF, fp );
+    }
+}
+
+/** Write the type and time of a frame record **/
+static void put_frame( struct recorder *rec, int type )
+{
+    unsigned int now;
+    
+    osal_get_systime( NULL, &now );
+    putc( type, rec->fp );
+    put_uint( rec->fp, now - rec->last_time );
+    rec->last_time = now;
+}
+
+/**
+    Open a recording.
+    
+    @param device    "FILE[,DRIVER[,DEVICE]]".
+    
+    @return Driver handle if successful, NULL if failed.
+**/
+static DRV_T rec_open( const char *device )
+{
+    struct recorder *rec;
+    char buf[MAX_DEVICE];
+    char *driver = NULL, *inner = NULL;
+    
+    if ( !device || strlen( device ) >= sizeof(buf) )
+        return NULL;
+    
+    strcpy( buf, device );
+    driver = strchr( buf, ',' );
+    if ( driver )
+    {
+        *driver++ = '\0';
+        inner = strchr( driver, ',' );
+        if ( inner )
+            *inner++ = '\0';
+    }
+    
+    rec = calloc( 1, sizeof(*rec) );
+    if ( !rec )
+        return NULL;
+    
+    /* Recording a recording is not going to end well */
+    rec->ops = drv_find( driver ? driver : "memory" );
+    if ( !rec->ops || rec->ops == &record_driver )
+    {
+        free( rec );
+        return NULL;
+    }
+    
+    rec->drv = rec->ops->open( inner );
+    if ( !rec->drv )
+    {
+        free( rec );
+        return NULL;
+    }
+    
+    rec->fp = fopen( buf, "wb" );
+    if ( !rec->fp )
+    {
+        rec->ops->close( rec->drv );
+        free( rec );
+        return NULL;
+    }
+    
+    osal_get_systime( NULL, &rec->last_time );
+    
+    fwrite( REC_MAGIC, 1, REC_MAGIC_LEN, rec->fp );
+    rec_get_screen_size( (DRV_T)rec, NULL, NULL );
+    fflush( rec->fp );
+    
+    return (DRV_T)rec;
+}
+
+/**
+    Read the size of the screen, recording it if it has changed.
+**/
+static void rec_get_screen_size( DRV_T drv, unsigned int *prows, unsigned int *pcols )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    unsigned int rows, cols;
+    
+    rec->ops->get_screen_size( rec->drv, &rows, &cols );
+    
+    if ( rows != rec->rows || cols != rec->cols )
+    {
+        putc( REC_SIZE, rec->fp );
+        put_uint( rec->fp, rows );
+        put_uint( rec->fp, cols );
+        rec->rows = rows;
+        rec->cols = cols;
+    }
+    
+    if ( prows ) *prows = rows;
+    if ( pcols ) *pcols = cols;
+}
+
+static void rec_set_resize_hook( DRV_RESIZE_HOOK_T hook )
+{
+    /* The hook is for all screens of a driver, so is not tied to any one
+       recording */
+    unsigned int i;
+    
+    for ( i = 0; ; i++ )
+    {
+        const struct drv_ops *ops = drv_get( i );
+        
+        if ( !ops )
+            break;
+        if ( ops != &record_driver && ops->set_resize_hook )
+            ops->set_resize_hook( hook );
+    }
+}
+
+static void rec_put_screen( DRV_T drv, STUI_CHAR_T *vbuf )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    put_frame( rec, REC_SCREEN );
+    put_cells( rec->fp, vbuf, rec->rows * rec->cols );
+    fflush( rec->fp );
+    
+    rec->scrolled = 0;
+    rec->ops->put_screen( rec->drv, vbuf );
+}
+
+/**
+    Record a frame of changed runs, and present it.  If the driver being
+    recorded cannot take the frame as it is, the whole screen is sent
+    instead.
+**/
+static void rec_put_runs( DRV_T drv, STUI_CHAR_T *vbuf, 
+                          const struct drv_run *runs, unsigned int n )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    unsigned int i;
+    
+    if ( n || rec->scrolled )
+    {
+        put_frame( rec, REC_RUNS );
+        put_uint( rec->fp, n );
+        for ( i = 0; i < n; i++ )
+        {
+            put_uint( rec->fp, runs[i].row );
+            put_uint( rec->fp, runs[i].col );
+            put_uint( rec->fp, runs[i].len );
+            put_cells( rec->fp, vbuf + ( runs[i].row * rec->cols ) + runs[i].col, 
+                       runs[i].len );
+        }
+        fflush( rec->fp );
+    }
+    
+    if ( !( rec->ops->caps & DRV_CAP_DIFF )
+        || ( rec->scrolled && !( rec->ops->caps & DRV_CAP_SCROLL ) ) )
+    {
+        if ( n || rec->scrolled )
+            rec->ops->put_screen( rec->drv, vbuf );
+    }
+    else
+        rec->ops->put_runs( rec->drv, vbuf, runs, n );
+    
+    rec->scrolled = 0;
+}
+
+static void rec_scroll( DRV_T drv, unsigned int top, unsigned int bottom, int n )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    putc( REC_SCROLL, rec->fp );
+    put_uint( rec->fp, top );
+    put_uint( rec->fp, bottom );
+    put_int( rec->fp, n );
+    
+    rec->scrolled = 1;
+    if ( rec->ops->caps & DRV_CAP_SCROLL )
+        rec->ops->scroll( rec->drv, top, bottom, n );
+}
+
+static void rec_begin_frame( DRV_T drv )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    if ( rec->ops->caps & DRV_CAP_SYNC )
+        rec->ops->begin_frame( rec->drv );
+}
+
+static void rec_end_frame( DRV_T drv )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    if ( rec->ops->caps & DRV_CAP_SYNC )
+        rec->ops->end_frame( rec->drv );
+}
+
+static void rec_close( DRV_T drv )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    rec->ops->close( rec->drv );
+    fclose( rec->fp );
+    free( rec );
+}
+
+/**
+    The bytes counted are those sent to the terminal by the driver being
+    recorded, not those written to the recording.
+**/
+static unsigned long rec_get_bytes( DRV_T drv )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    return rec->ops->get_bytes ? rec->ops->get_bytes( rec->drv ) : 0;
+}
+
+/*****************************************************************************/
+/* Public functions.  Defined in header file.                                */
+/*****************************************************************************/
+
+/**
+    Get the driver a recording passes its frames on to, for example to use
+    the memory driver's accessors on a recorded context.
+    
+    @param drv       Recording driver handle, from stui_context_get_driver().
+    @param p_ops     Pointer to store the driver's table of operations.  Can
+                     be NULL.
+    
+    @return Handle of the driver being recorded.
+**/
+extern DRV_T rec_get_driver( DRV_T drv, const struct drv_ops **p_ops )
+{
+    struct recorder *rec = (struct recorder *)drv;
+    
+    if ( p_ops )
+        *p_ops = rec->ops;
+    
+    return rec->drv;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
@@ -0,0 +1,87 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "driver_api.h"
+
+/**
+   Recording file format.
+   
+   The recording driver, registered as "record", writes every frame the server
+   presents to a file, passing it on to another driver as it goes.  Its device
+   is given as "FILE[,DRIVER[,DEVICE]]", recording to FILE and presenting on
+   DEVICE of DRIVER.  If no driver is given the frames go to the memory driver,
+   so a session can be recorded with no terminal at all.
+   
+   The file starts with the 8 bytes of REC_MAGIC, followed by a sequence of
+   records.  Each record is a type byte followed by its fields.  All numbers
+   are unsigned LEB128 variable-length integers, apart from cells, which are
+   two bytes, low byte first.  Signed numbers are zigzag encoded, so that
+   0, -1, 1, -2... become 0, 1, 2, 3...
+   
+     REC_SIZE    rows, cols
+                 The screen is now this size.  Always the first record.
+     REC_SCROLL  top, bottom, n (signed)
+                 Rows top to bottom-1 scroll by n, up if positive, as part of
+                 the next frame.
+     REC_RUNS    dt, count, then count times: row, col, len, len cells
+                 A frame of changed runs of cells.
+     REC_SCREEN  dt, rows * cols cells
+                 A frame of the whole screen.
+   
+   The dt of a frame is the time in microseconds since the previous frame, or
+   since the recording started for the first.
+**/
+
+#define REC_MAGIC       "STUIREC1"
+#define REC_MAGIC_LEN   ( 8 )
+
+#define REC_SIZE        ( 'S' )
+#define REC_SCROLL      ( 'C' )
+#define REC_RUNS        ( 'R' )
+#define REC_SCREEN      ( 'P' )
+
+/**
+   The handle stui_context_get_driver() gives for a recorded context is the
+   recording's, not that of the driver being recorded, so the memory driver's
+   accessors cannot be used on it.  rec_get_driver() gives the handle of the
+   driver being recorded, and its table of operations.
+**/
+
+extern DRV_T rec_get_driver( DRV_T, const struct drv_ops ** );
+
+#endif /* RECORD_H */
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
@@ -42,6 +42,7 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <errno.h>
 
 
 /*****************************************************************************/
@@ -49,6 +50,7 @@
 /*****************************************************************************/
 
 #include "driver_api.h"
+#include "xterm_enc.h"
 
 /*****************************************************************************/
 /* Macros, constants                                                         */
@@ -59,16 +61,23 @@
 /* Data types                                                                */
 /*****************************************************************************/
 
-
+/**
+   An open terminal.  Output is assembled by the encoder and written to the
+   tty in one go.
+**/
+struct xterm {
+    int fd;
+    unsigned int rows, cols;
+    int in_frame;
+    struct xterm_enc enc;
+};
 
 /*****************************************************************************/
 /* Private Data.  Declare as static.                                         */
 /*****************************************************************************/
 
-
-
-static int fd = 0;
-static unsigned int rows, cols;
+/** Called from the SIGWINCH handler to tell the server about the change **/
+static volatile DRV_RESIZE_HOOK_T resize_hook = NULL;
 
 
 /*****************************************************************************/
@@ -76,99 +85,256 @@ static unsigned int rows, cols;
 /*****************************************************************************/
 
 
-static void update_size( void );
+static void update_size( struct xterm * );
 static void resize_tty( int );
-static void xterm_out( STUI_CHAR_T );
+static void tty_write( void *, const char *, size_t );
+
+static DRV_T xterm_open( const char * );
+static void xterm_get_screen_size( DRV_T, unsigned int *, unsigned int * );
+static void xterm_set_resize_hook( DRV_RESIZE_HOOK_T );
+static void xterm_put_screen( DRV_T, STUI_CHAR_T * );
+static void xterm_put_runs( DRV_T, STUI_CHAR_T *, const struct drv_run *, unsigned int );
+static void xterm_scroll( DRV_T, unsigned int, unsigned int, int );
+static void xterm_begin_frame( DRV_T );
+static void xterm_end_frame( DRV_T );
+static void xterm_close( DRV_T );
+static unsigned long xterm_get_bytes( DRV_T );
+
+/*****************************************************************************/
+/* Public Data.                                                              */
+/*****************************************************************************/
+
+/**
+   The xterm driver.  Frames are sent with synchronized output (DEC private
+   mode 2026), which terminals that do not support it ignore.
+**/
+const struct drv_ops xterm_driver = {
+    "xterm",
+    DRV_CAP_DIFF | DRV_CAP_SCROLL | DRV_CAP_SYNC,
+    xterm_open,
+    xterm_get_screen_size,
+    xterm_set_resize_hook,
+    xterm_put_screen,
+    xterm_put_runs,
+    xterm_scroll,
+    xterm_begin_frame,
+    xterm_end_frame,
+    xterm_close,
+    xterm_get_bytes
+};
 
 
 /*****************************************************************************/
 /* Private functions.  Declare as static.                                    */
 /*****************************************************************************/
 
-static void update_size( void )
+static void update_size( struct xterm *xt )
 {
     struct winsize ws;
 
-    if ( !ioctl( fd, TIOCGWINSZ, &ws ) )
+    if ( !ioctl( xt->fd, TIOCGWINSZ, &ws ) )
     {
-        cols = ws.ws_col;
-        rows = ws.ws_row;
+        /* The terminal may have reflowed or cleared the screen, so the
+           cursor position and attributes can no longer be relied on */
+        if ( ws.ws_col != xt->cols || ws.ws_row != xt->rows )
+            xenc_invalidate( &xt->enc );
+        
+        xt->cols = ws.ws_col;
+        xt->rows = ws.ws_row;
+        xenc_set_size( &xt->enc, xt->rows, xt->cols );
     }
 }
 
-
+/** 
+    SIGWINCH handler.  All the work is left to the server, which reads the new
+    size with xterm_get_screen_size().  The signal does not say which terminal
+    changed, so the server checks all of them.
+**/
 static void resize_tty( int sig )
 {
+    int saved_errno = errno;
+    
+    (void)sig;
     signal( SIGWINCH, resize_tty );
     
-    /* Do something about this ? */ 
+    if ( resize_hook )
+        resize_hook();
+    
+    errno = saved_errno;
 }
 
-static void xterm_out( STUI_CHAR_T sc )
+/** Encoder sink: write the whole buffer to the tty **/
+static void tty_write( void *arg, const char *buf, size_t len )
 {
-    printf( "\x1B[0" );
-    
-    if ( sc & STUI_ATTR_BOLD )
-        printf( ";1" );
-    if ( sc & STUI_ATTR_BLINK )
-        printf( ";5" );
-    if ( sc & STUI_ATTR_REVERSE )
-        printf( ";7" );
-    if ( sc & STUI_ATTR_UNDLINE )
-        printf( ";4" );
+    struct xterm *xt = (struct xterm *)arg;
+    
+    while ( len )
+    {
+        ssize_t n = write( xt->fd, buf, len );
+        
+        if ( n < 0 )
+        {
+            if ( EINTR == errno )
+                continue;
+            break;
+        }
         
-    putchar( 'm' );
-    putchar( sc & STUI_CHAR_MASK );
+        buf += n;
+        len -= n;
+    }
 }
 
-static void goto_rowcol( unsigned int row, unsigned int col )
+/**
+    Open a terminal.
+    
+    @param device    Path of the terminal device, or NULL for the process's
+                     controlling terminal.
+    
+    @return Driver handle if successful, NULL if failed.
+**/
+static DRV_T xterm_open( const char *device )
 {
-    printf( "\x1B[%d;%dH", row+1, col+1 );
+    struct xterm *xt = calloc( 1, sizeof(*xt) );
+    
+    if ( !xt )
+        return NULL;
+    
+    xt->fd = open( device ? device : "/dev/tty", O_RDWR | O_NOCTTY );
+    if ( xt->fd < 0 )
+    {
+        free( xt );
+        return NULL;
+    }
+    
+    if ( xenc_init( &xt->enc, tty_write, xt ) )
+    {
+        close( xt->fd );
+        free( xt );
+        return NULL;
+    }
+        
+    signal( SIGWINCH, resize_tty );
+        
+    update_size( xt );
+    
+    return (DRV_T)xt;
 }
 
-/*****************************************************************************/
-/* Public functions.  Defined in header file.                                */
-/*****************************************************************************/
+static void xterm_get_screen_size( DRV_T drv, unsigned int *prows, unsigned int *pcols )
+{
+    struct xterm *xt = (struct xterm *)drv;
+    
+    update_size( xt );
+    if ( prows ) *prows = xt->rows;
+    if ( pcols ) *pcols = xt->cols;
+}
+
+/**
+    Register the function to call when a terminal is resized.
+    
+    @param hook      Function to call, or NULL for none.
+**/
+static void xterm_set_resize_hook( DRV_RESIZE_HOOK_T hook )
+{
+    resize_hook = hook;
+}
 
 
-int drv_open( void )
+static void xterm_put_screen( DRV_T drv, STUI_CHAR_T *vbuf )
 {
-    fd = open( "/dev/tty", O_RDWR );
-	if ( !fd )
-		return -1;
-        
-    signal( SIGWINCH, resize_tty );
-        
-    update_size();
+    struct xterm *xt = (struct xterm *)drv;
+    
+    xenc_put_screen( &xt->enc, vbuf );
+    if ( !xt->in_frame )
+        xenc_flush( &xt->enc );
+}
+
+/**
+    Output only the changed cells of the screen.
+    
+    @param drv       Driver handle.
+    @param vbuf      Visual buffer holding the complete new screen.
+    @param runs      Array of runs of changed cells.
+    @param n         Number of runs.
+**/
+static void xterm_put_runs( DRV_T drv, STUI_CHAR_T *vbuf, 
+                            const struct drv_run *runs, unsigned int n )
+{
+    struct xterm *xt = (struct xterm *)drv;
     
-    return 0;
+    xenc_put_runs( &xt->enc, vbuf, runs, n );
+    if ( !xt->in_frame )
+        xenc_flush( &xt->enc );
 }
 
-void drv_get_screen_size( unsigned int *prows, unsigned int *pcols )
+/**
+    Scroll a band of rows of the screen.  The output is sent along with the
+    next call to xterm_put_runs().
+    
+    @param drv       Driver handle.
+    @param top       First row of the band.
+    @param bottom    Row after the last row of the band.
+    @param n         Rows to scroll by, positive for up, negative for down.
+**/
+static void xterm_scroll( DRV_T drv, unsigned int top, unsigned int bottom, int n )
 {
-    update_size();
-    if ( prows ) *prows = rows;
-    if ( pcols ) *pcols = cols;
+    struct xterm *xt = (struct xterm *)drv;
+    
+    xenc_scroll( &xt->enc, top, bottom, n );
 }
 
+/**
+    Start the output for a frame.  Nothing is sent to the terminal until the
+    end of the frame, which the terminal then shows all at once.
+    
+    @param drv       Driver handle.
+**/
+static void xterm_begin_frame( DRV_T drv )
+{
+    struct xterm *xt = (struct xterm *)drv;
+    
+    xt->in_frame = 1;
+    xenc_put_string( &xt->enc, "\x1B[?2026h" );
+}
 
-extern void drv_put_screen( STUI_CHAR_T *vbuf )
+/**
+    Finish the output for a frame and send it to the terminal.
+    
+    @param drv       Driver handle.
+**/
+static void xterm_end_frame( DRV_T drv )
 {
-    int r, c;
+    struct xterm *xt = (struct xterm *)drv;
     
-    goto_rowcol( 0, 0 );
-    for ( r = 0; r < rows; r++ )
-        for ( c = 0; c < cols; c++ )
-            xterm_out( *vbuf++ );
-    fflush(stdout);
+    xenc_put_string( &xt->enc, "\x1B[?2026l" );
+    xenc_flush( &xt->enc );
+    xt->in_frame = 0;
 }
 
-extern void drv_close( void )
+static void xterm_close( DRV_T drv )
 {
-    close( fd );
-    fd = 0;
-    printf( "\x1B[0m\x1B[1;1H\x1B[2J" );
-    fflush( stdout );
+    struct xterm *xt = (struct xterm *)drv;
+    
+    xenc_put_string( &xt->enc, "\x1B[0m\x1B[1;1H\x1B[2J" );
+    xenc_flush( &xt->enc );
+    xenc_free( &xt->enc );
+    
+    close( xt->fd );
+    free( xt );
+}
+
+/**
+    Get the number of bytes written to the terminal.
+    
+    @param drv       Driver handle.
+    
+    @return Number of bytes.
+**/
+static unsigned long xterm_get_bytes( DRV_T drv )
+{
+    struct xterm *xt = (struct xterm *)drv;
+    
+    return xt->enc.bytes;
 }
 
 /*****************************************************************************/
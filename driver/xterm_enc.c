@@ -0,0 +1,712 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "xterm_enc.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+/** Attribute state used when the terminal's attributes are not known **/
+#define ATTR_UNKNOWN    ( ~0U )
+
+/** Initial size of the output buffer.  It grows as needed. **/
+#define INITIAL_SIZE    ( 4096 )
+
+/** Characters that REP can repeat **/
+#define IS_GRAPHIC(c)   ( (c) >= 0x20 && (c) < 0x7F )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   Ways of moving the cursor, vertically then horizontally.
+**/
+enum vmove { V_NONE, V_CUP, V_CUD, V_CUU, V_CRLF };
+enum hmove { H_NONE, H_CUF, H_CUB, H_BS, H_REPRINT };
+
+struct motion {
+    unsigned int cost;
+    int cr;                     /* Start with a carriage return */
+    enum vmove v;
+    enum hmove h;
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+/** Mapping from character attributes to SGR parameters **/
+static const struct {
+    unsigned int attr;
+    char code;
+} sgr_codes[] = {
+    { STUI_ATTR_BOLD,    '1' },
+    { STUI_ATTR_UNDLINE, '4' },
+    { STUI_ATTR_BLINK,   '5' },
+    { STUI_ATTR_REVERSE, '7' }
+};
+
+#define NUM_SGR_CODES   ( sizeof(sgr_codes) / sizeof(sgr_codes[0]) )
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/*****************************************************************************/
+/**
+    Double the size of the output buffer.
+    
+    @return non-zero if successful.
+**/
+static int grow( struct xterm_enc *enc )
+{
+    size_t size = enc->size ? enc->size * 2 : INITIAL_SIZE;
+    char *p = realloc( enc->buf, size );
+    
+    if ( !p )
+        return 0;
+        
+    enc->buf  = p;
+    enc->size = size;
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+    Append bytes to the output buffer.  If the buffer cannot grow then what
+    has been collected so far is flushed out to make room.
+**/
+static void put_bytes( struct xterm_enc *enc, const char *s, size_t n )
+{
+    while ( n )
+    {
+        size_t k;
+        
+        if ( enc->len == enc->size && !grow( enc ) )
+        {
+            xenc_flush( enc );
+            if ( !enc->size )
+                return;
+        }
+        
+        k = enc->size - enc->len;
+        if ( k > n )
+            k = n;
+        
+        memcpy( enc->buf + enc->len, s, k );
+        enc->len += k;
+        s        += k;
+        n        -= k;
+    }
+}
+
+/*****************************************************************************/
+/**
+    Append a single byte to the output buffer.
+**/
+static void put_char( struct xterm_enc *enc, char c )
+{
+    if ( enc->len < enc->size )
+        enc->buf[enc->len++] = c;
+    else
+        put_bytes( enc, &c, 1 );
+}
+
+/*****************************************************************************/
+/**
+    Append a decimal number to the output buffer.
+**/
+static void put_num( struct xterm_enc *enc, unsigned int n )
+{
+    char digits[12];
+    unsigned int i = sizeof(digits);
+    
+    do {
+        digits[--i] = '0' + ( n % 10 );
+        n /= 10;
+    } while ( n );
+    
+    put_bytes( enc, digits + i, sizeof(digits) - i );
+}
+
+/*****************************************************************************/
+/**
+    Bring the terminal's character attributes into line with attr, sending an
+    SGR sequence only if they differ.  If attributes only need adding then
+    they are added to the current set, otherwise the attributes are reset and
+    set afresh.
+**/
+static void set_attr( struct xterm_enc *enc, unsigned int attr )
+{
+    unsigned int add, i;
+    int sep = 0;
+    
+    if ( attr == enc->attr )
+        return;
+    
+    put_bytes( enc, "\x1B[", 2 );
+    
+    if ( enc->attr == ATTR_UNKNOWN || ( enc->attr & ~attr ) )
+    {
+        put_char( enc, '0' );
+        add = attr;
+        sep = 1;
+    }
+    else
+        add = attr & ~enc->attr;
+    
+    for ( i = 0; i < NUM_SGR_CODES; i++ )
+    {
+        if ( add & sgr_codes[i].attr )
+        {
+            if ( sep )
+                put_char( enc, ';' );
+            put_char( enc, sgr_codes[i].code );
+            sep = 1;
+        }
+    }
+    
+    put_char( enc, 'm' );
+    enc->attr = attr;
+}
+
+/*****************************************************************************/
+/**
+    Output a single attributed character.
+**/
+static void put_cell( struct xterm_enc *enc, STUI_CHAR_T sc )
+{
+    set_attr( enc, sc & ~STUI_CHAR_MASK );
+    put_char( enc, sc & STUI_CHAR_MASK );
+}
+
+/*****************************************************************************/
+/**
+    Number of digits in a decimal number.
+**/
+static unsigned int num_len( unsigned int n )
+{
+    unsigned int len = 1;
+    
+    while ( n >= 10 )
+    {
+        n /= 10;
+        len++;
+    }
+    
+    return len;
+}
+
+/*****************************************************************************/
+/**
+    Length of a control sequence "CSI n X", where a count of 1 is implied.
+**/
+static unsigned int seq_cost( unsigned int n )
+{
+    return n == 1 ? 3 : 3 + num_len( n );
+}
+
+/*****************************************************************************/
+/**
+    Output a control sequence "CSI n X", where a count of 1 is implied.
+**/
+static void put_seq( struct xterm_enc *enc, unsigned int n, char final )
+{
+    put_bytes( enc, "\x1B[", 2 );
+    if ( n != 1 )
+        put_num( enc, n );
+    put_char( enc, final );
+}
+
+/*****************************************************************************/
+/**
+    Length of the absolute cursor position sequence for a given position.
+**/
+static unsigned int cup_cost( unsigned int row, unsigned int col )
+{
+    if ( 0 == col )
+        return 0 == row ? 3 : 3 + num_len( row + 1 );
+    return 4 + num_len( row + 1 ) + num_len( col + 1 );
+}
+
+/*****************************************************************************/
+/**
+    Output the absolute cursor position sequence.
+**/
+static void put_cup( struct xterm_enc *enc, unsigned int row, unsigned int col )
+{
+    put_bytes( enc, "\x1B[", 2 );
+    if ( row || col )
+        put_num( enc, row + 1 );
+    if ( col )
+    {
+        put_char( enc, ';' );
+        put_num( enc, col + 1 );
+    }
+    put_char( enc, 'H' );
+}
+
+/*****************************************************************************/
+/**
+    Check whether the cells between two columns of a row can be reprinted
+    without any attribute changes.  The caller guarantees that the terminal
+    already shows these cells, so reprinting them just moves the cursor.
+**/
+static int can_reprint( const struct xterm_enc *enc, const STUI_CHAR_T *vbuf,
+                        unsigned int row, unsigned int from, unsigned int to )
+{
+    const STUI_CHAR_T *p = vbuf + ( row * enc->cols );
+    
+    for ( ; from < to; from++ )
+        if ( ( p[from] & ~STUI_CHAR_MASK ) != enc->attr )
+            return 0;
+    
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+    Find the cheapest way of moving along a row.  Reprinting is only tried if
+    it could be shorter than a cursor forward sequence.
+**/
+static unsigned int horiz_cost( const struct xterm_enc *enc, 
+                                const STUI_CHAR_T *vbuf, unsigned int row,
+                                unsigned int from, unsigned int to,
+                                enum hmove *how )
+{
+    unsigned int n;
+    
+    if ( to == from )
+    {
+        *how = H_NONE;
+        return 0;
+    }
+    
+    if ( to < from )
+    {
+        n = from - to;
+        *how = n < seq_cost( n ) ? H_BS : H_CUB;
+        return n < seq_cost( n ) ? n : seq_cost( n );
+    }
+    
+    n = to - from;
+    if ( n < seq_cost( n ) && can_reprint( enc, vbuf, row, from, to ) )
+    {
+        *how = H_REPRINT;
+        return n;
+    }
+    
+    *how = H_CUF;
+    return seq_cost( n );
+}
+
+/*****************************************************************************/
+/**
+    Consider a candidate motion, keeping it if it is cheaper than the best
+    found so far.
+**/
+static void try_motion( struct motion *best, unsigned int cost, int cr,
+                        enum vmove v, enum hmove h )
+{
+    if ( cost < best->cost )
+    {
+        best->cost = cost;
+        best->cr   = cr;
+        best->v    = v;
+        best->h    = h;
+    }
+}
+
+/*****************************************************************************/
+/**
+    Move the cursor to the given position by the cheapest means, chosen from
+    absolute positioning, relative motion, carriage return and line feed, and
+    reprinting the characters already on screen.
+    
+    The cells before the target position on the target row must be unchanged
+    since they may be reprinted.
+**/
+static void move_to( struct xterm_enc *enc, const STUI_CHAR_T *vbuf,
+                     unsigned int row, unsigned int col )
+{
+    struct motion best;
+    unsigned int vcost, hcost, dr;
+    enum vmove v;
+    enum hmove h;
+    
+    if ( enc->cur_valid && enc->cur_row == row && enc->cur_col == col )
+        return;
+    
+    best.cost = cup_cost( row, col );
+    best.cr   = 0;
+    best.v    = V_CUP;
+    best.h    = H_NONE;
+    
+    if ( enc->cur_valid && ( enc->opts & XENC_OPT_MOTION ) )
+    {
+        /* Vertical motion, by itself or followed by a CR */
+        if ( row == enc->cur_row )
+        {
+            v     = V_NONE;
+            vcost = 0;
+        }
+        else if ( row > enc->cur_row )
+        {
+            v     = V_CUD;
+            vcost = seq_cost( row - enc->cur_row );
+        }
+        else
+        {
+            v     = V_CUU;
+            vcost = seq_cost( enc->cur_row - row );
+        }
+        
+        /* Relative moves are not reliable while waiting to wrap */
+        if ( enc->cur_col < enc->cols )
+        {
+            hcost = horiz_cost( enc, vbuf, row, enc->cur_col, col, &h );
+            try_motion( &best, vcost + hcost, 0, v, h );
+        }
+        
+        hcost = horiz_cost( enc, vbuf, row, 0, col, &h );
+        try_motion( &best, 1 + vcost + hcost, 1, v, h );
+        
+        /* A CR LF pair per row moving downwards */
+        if ( row > enc->cur_row )
+        {
+            dr = row - enc->cur_row;
+            try_motion( &best, 2 * dr + hcost, 0, V_CRLF, h );
+        }
+    }
+    
+    if ( best.cr )
+        put_char( enc, '\r' );
+    
+    switch ( best.v )
+    {
+        case V_CUP:
+            put_cup( enc, row, col );
+            break;
+        case V_CUD:
+            put_seq( enc, row - enc->cur_row, 'B' );
+            break;
+        case V_CUU:
+            put_seq( enc, enc->cur_row - row, 'A' );
+            break;
+        case V_CRLF:
+            for ( dr = enc->cur_row; dr < row; dr++ )
+                put_bytes( enc, "\r\n", 2 );
+            break;
+        default:
+            break;
+    }
+    
+    if ( best.v != V_CUP )
+    {
+        unsigned int from = ( best.cr || best.v == V_CRLF ) ? 0 : enc->cur_col;
+        
+        switch ( best.h )
+        {
+            case H_CUF:
+                put_seq( enc, col - from, 'C' );
+                break;
+            case H_CUB:
+                put_seq( enc, from - col, 'D' );
+                break;
+            case H_BS:
+                for ( ; from > col; from-- )
+                    put_char( enc, '\b' );
+                break;
+            case H_REPRINT:
+                for ( ; from < col; from++ )
+                    put_char( enc, vbuf[ ( row * enc->cols ) + from ] & STUI_CHAR_MASK );
+                break;
+            default:
+                break;
+        }
+    }
+    
+    enc->cur_row   = row;
+    enc->cur_col   = col;
+    enc->cur_valid = 1;
+}
+
+/*****************************************************************************/
+/**
+    Output a run of cells on one row, starting at the cursor position.
+    Repeated characters are sent with REP, and a trailing run of plain blanks
+    may be erased with ECH instead.
+**/
+static void put_run( struct xterm_enc *enc, const STUI_CHAR_T *p, 
+                     unsigned int len )
+{
+    unsigned int i = 0, k;
+    
+    while ( i < len )
+    {
+        STUI_CHAR_T sc = p[i];
+        unsigned int print_cost;
+        
+        for ( k = 1; i + k < len && p[i + k] == sc; k++ )
+            ;
+        
+        /* Cheapest way of printing the k characters */
+        print_cost = k;
+        if ( ( enc->opts & XENC_OPT_REP ) && k > 1 
+            && IS_GRAPHIC( sc & STUI_CHAR_MASK ) && 1 + seq_cost( k - 1 ) < k )
+            print_cost = 1 + seq_cost( k - 1 );
+        
+        /* ECH leaves the cursor where it is, so only use it at the end */
+        if ( ( enc->opts & XENC_OPT_ECH ) && i + k == len && sc == ' '
+            && seq_cost( k ) < print_cost )
+        {
+            set_attr( enc, 0 );
+            put_seq( enc, k, 'X' );
+            enc->cur_col += i;
+            return;
+        }
+        
+        put_cell( enc, sc );
+        if ( print_cost < k )
+            put_seq( enc, k - 1, 'b' );
+        else
+        {
+            unsigned int j;
+            
+            for ( j = 1; j < k; j++ )
+                put_char( enc, sc & STUI_CHAR_MASK );
+        }
+        
+        i += k;
+    }
+    
+    enc->cur_col += len;
+}
+
+/*****************************************************************************/
+/* Public functions.  Defined in header file.                                */
+/*****************************************************************************/
+
+/*****************************************************************************/
+/**
+    Initialise an encoder.
+    
+    @param enc       Encoder to initialise.
+    @param sink      Function called with the output when flushed.
+    @param arg       Argument passed to the sink function.
+    
+    @return 0 if successful, -1 if failure.
+**/
+extern int xenc_init( struct xterm_enc *enc, XENC_SINK_T sink, void *arg )
+{
+    memset( enc, 0, sizeof(*enc) );
+    enc->sink     = sink;
+    enc->sink_arg = arg;
+    enc->opts     = XENC_OPT_ALL;
+    enc->attr     = ATTR_UNKNOWN;
+    
+    return grow( enc ) ? 0 : -1;
+}
+
+/*****************************************************************************/
+/**
+    Release the resources held by an encoder.  Any unflushed output is lost.
+    
+    @param enc       Encoder to release.
+**/
+extern void xenc_free( struct xterm_enc *enc )
+{
+    free( enc->buf );
+    enc->buf  = NULL;
+    enc->len  = 0;
+    enc->size = 0;
+}
+
+/*****************************************************************************/
+/**
+    Set the dimensions of the screen being encoded.
+    
+    @param enc       Encoder to modify.
+    @param rows      Number of rows.
+    @param cols      Number of columns.
+**/
+extern void xenc_set_size( struct xterm_enc *enc, 
+                           unsigned int rows, unsigned int cols )
+{
+    enc->rows = rows;
+    enc->cols = cols;
+}
+
+/*****************************************************************************/
+/**
+    Forget the terminal state, for example after something else has written
+    to the terminal.  The next output re-establishes it.
+    
+    @param enc       Encoder to modify.
+**/
+extern void xenc_invalidate( struct xterm_enc *enc )
+{
+    enc->attr      = ATTR_UNKNOWN;
+    enc->cur_valid = 0;
+}
+
+/*****************************************************************************/
+/**
+    Encode the entire screen.
+    
+    @param enc       Encoder to use.
+    @param vbuf      Visual buffer of rows x cols cells.
+**/
+extern void xenc_put_screen( struct xterm_enc *enc, const STUI_CHAR_T *vbuf )
+{
+    unsigned int row;
+    
+    for ( row = 0; row < enc->rows; row++ )
+    {
+        move_to( enc, vbuf, row, 0 );
+        put_run( enc, vbuf + ( row * enc->cols ), enc->cols );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Encode runs of changed cells.
+    
+    @param enc       Encoder to use.
+    @param vbuf      Visual buffer of rows x cols cells.
+    @param runs      Array of runs of changed cells.
+    @param n         Number of runs.
+**/
+extern void xenc_put_runs( struct xterm_enc *enc, const STUI_CHAR_T *vbuf,
+                           const struct drv_run *runs, unsigned int n )
+{
+    unsigned int i;
+    
+    for ( i = 0; i < n; i++ )
+    {
+        move_to( enc, vbuf, runs[i].row, runs[i].col );
+        put_run( enc, vbuf + ( runs[i].row * enc->cols ) + runs[i].col, 
+                 runs[i].len );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Scroll a band of whole rows of the terminal.  The rows scrolled into view
+    are blank.
+    
+    @param enc       Encoder to use.
+    @param top       First row of the band.
+    @param bottom    Row after the last row of the band.
+    @param n         Number of rows to scroll by.  Positive values move the
+                     contents up, negative values move them down.
+**/
+extern void xenc_scroll( struct xterm_enc *enc, 
+                         unsigned int top, unsigned int bottom, int n )
+{
+    int full = ( 0 == top && bottom == enc->rows );
+    
+    /* New rows take on the current attributes, so make sure they are plain */
+    set_attr( enc, 0 );
+    
+    /* DECSTBM, which also homes the cursor */
+    if ( !full )
+    {
+        put_bytes( enc, "\x1B[", 2 );
+        put_num( enc, top + 1 );
+        put_char( enc, ';' );
+        put_num( enc, bottom );
+        put_char( enc, 'r' );
+    }
+    
+    /* SU or SD */
+    if ( n > 0 )
+        put_seq( enc, (unsigned int)n, 'S' );
+    else
+        put_seq( enc, (unsigned int)-n, 'T' );
+    
+    /* Restore the full screen scrolling region */
+    if ( !full )
+    {
+        put_bytes( enc, "\x1B[r", 3 );
+        enc->cur_row   = 0;
+        enc->cur_col   = 0;
+        enc->cur_valid = 1;
+    }
+}
+
+/*****************************************************************************/
+/**
+    Append a raw control string to the output.
+    
+    @param enc       Encoder to use.
+    @param s         Nul-terminated string to output.
+**/
+extern void xenc_put_string( struct xterm_enc *enc, const char *s )
+{
+    put_bytes( enc, s, strlen( s ) );
+}
+
+/*****************************************************************************/
+/**
+    Send the buffered output to the sink.
+    
+    @param enc       Encoder to flush.
+**/
+extern void xenc_flush( struct xterm_enc *enc )
+{
+    if ( enc->len )
+    {
+        if ( enc->sink )
+            enc->sink( enc->sink_arg, enc->buf, enc->len );
+        enc->bytes += enc->len;
+        enc->len    = 0;
+    }
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
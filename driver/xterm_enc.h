@@ -0,0 +1,99 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+ 
+#ifndef XTERM_ENC_H
+#define XTERM_ENC_H
+
+#include <stddef.h>
+
+#include "driver_api.h"
+
+/**
+   The xterm encoder turns screen contents into the byte stream understood by
+   xterm-compatible terminals.  Output is assembled into a single buffer and
+   handed to a caller-supplied sink function when the encoder is flushed,
+   allowing the same encoder to drive a tty, a file, or nothing at all.
+   
+   The encoder remembers the terminal's current character attributes so that
+   SGR sequences are only sent when the attributes change.  It also tracks the
+   cursor position, choosing the cheapest way of moving it between changed
+   cells, and compresses runs of repeated characters.
+**/
+/** Optimisations, which may be turned off individually for comparison **/
+#define XENC_OPT_MOTION     ( 1 << 0 )  /* Relative cursor motion           */
+#define XENC_OPT_REP        ( 1 << 1 )  /* REP for repeated characters      */
+#define XENC_OPT_ECH        ( 1 << 2 )  /* ECH for trailing runs of blanks  */
+#define XENC_OPT_ALL        ( XENC_OPT_MOTION | XENC_OPT_REP | XENC_OPT_ECH )
+
+typedef void (*XENC_SINK_T)( void * /* arg */, const char * /* buf */, size_t /* len */ );
+
+struct xterm_enc {
+    /* Output buffer */
+    char *buf;
+    size_t len, size;
+    
+    /* Where to send the output, and its argument */
+    XENC_SINK_T sink;
+    void *sink_arg;
+    
+    /* Enabled optimisations, XENC_OPT_xxx */
+    unsigned int opts;
+    
+    /* Terminal state.  A cursor column of cols means that the cursor is
+       waiting to wrap after writing the last column. */
+    unsigned int rows, cols;
+    unsigned int attr;
+    unsigned int cur_row, cur_col;
+    int cur_valid;
+    
+    /* Total number of bytes sent to the sink */
+    unsigned long bytes;
+};
+
+extern int  xenc_init( struct xterm_enc *, XENC_SINK_T, void * );
+extern void xenc_free( struct xterm_enc * );
+extern void xenc_set_size( struct xterm_enc *, unsigned int, unsigned int );
+extern void xenc_invalidate( struct xterm_enc * );
+
+extern void xenc_put_screen( struct xterm_enc *, const STUI_CHAR_T * );
+extern void xenc_put_runs( struct xterm_enc *, const STUI_CHAR_T *,
+                           const struct drv_run *, unsigned int );
+extern void xenc_scroll( struct xterm_enc *, unsigned int, unsigned int, int );
+extern void xenc_put_string( struct xterm_enc *, const char * );
+
+extern void xenc_flush( struct xterm_enc * );
+
+#endif /* XTERM_ENC_H */
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
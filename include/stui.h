@@ -64,6 +64,18 @@ enum {
 **/
 typedef void * STUI_WINDOW_T;
 
+/**
+   Each terminal driven by the server has a context, holding its screen and
+   windows.  Contexts are also managed by opaque handles, and a handle of NULL
+   refers to the default context opened by stui_server().
+**/
+typedef void * STUI_CONTEXT_T;
+
+/**
+   Window properties, given when the window is created.
+**/
+#define STUI_WINDOW_RETAINED    ( 1 << 0 )
+
 /**
    Applications must associate a callback with each window created.  This is
    callbed by the server when the window needs to be repainted.  As well as the
@@ -88,8 +100,12 @@ typedef void * STUI_WINDOW_T;
    that has been removed).  In this case the coordinates of the dirty region
    are:
        topleft_(row,col) = 2,9
-       btmright_(row,col) = 6,24
+       btmright_(row,col) = 7,25
    
+   The bottom-right coordinates are exclusive, i.e. they are one past the last
+   dirty row and column.  Output outside the dirty region is discarded, and the
+   callback may be called several times in one refresh if the window has
+   separate dirty regions.
 **/
 typedef void (*STUI_CALLBACK_T)( STUI_WINDOW_T /* hWnd    */ , 
                                  unsigned int  /* topleft_row */ ,
@@ -97,13 +113,81 @@ typedef void (*STUI_CALLBACK_T)( STUI_WINDOW_T /* hWnd    */ ,
                                  unsigned int  /* btmright_row */ ,
                                  unsigned int  /* btmright_col */ );
 
+/**
+   The application can be told about changes to the terminal, such as it being
+   resized, by a notification function.  It is given the context it concerns,
+   the message (one of STUI_MSG_xxx) and two message-specific parameters.
+**/
+typedef void (*STUI_NOTIFY_T)( STUI_CONTEXT_T /* hCtx */ ,
+                               int            /* msg */ ,
+                               unsigned int   /* param1 */ ,
+                               unsigned int   /* param2 */ );
+
+/**
+   Statistics kept by the server for each context, read with
+   stui_context_get_stats().  They are totals since the context was opened,
+   and times are in microseconds, so rates and averages are found from the
+   difference between two readings.  The totals may wrap.  Only a sample of
+   the holds of the lock are timed, see STUI_LOCK_SAMPLE, so the time the
+   lock is held is estimated from lock_hold_us, locks_timed and locks.
+**/
+typedef struct {
+    unsigned long frames;           /* Frames presented */
+    unsigned long frames_skipped;   /* Times woken with nothing to present */
+    unsigned long frame_us;         /* Time spent drawing frames */
+    unsigned long frame_max_us;     /* Longest frame */
+    unsigned long callbacks;        /* Window callbacks made */
+    unsigned long callbacks_max;    /* Most callbacks made in one frame */
+    unsigned long paint_us;         /* Time spent in window callbacks */
+    unsigned long cells;            /* Cells changed on the screen */
+    unsigned long bytes;            /* Bytes sent to the terminal */
+    unsigned long latency_us;       /* Time from first change to frame */
+    unsigned long latency_max_us;   /* Longest time from change to frame */
+    unsigned long locks;            /* Times the context was locked */
+    unsigned long lock_waits;       /* Times the lock had to be waited for */
+    unsigned long lock_wait_us;     /* Time spent waiting for the lock */
+    unsigned long locks_timed;      /* Times the lock hold was timed */
+    unsigned long lock_hold_us;     /* Time the lock was held, when timed */
+    unsigned long lock_hold_max_us; /* Longest timed hold of the lock */
+} STUI_STATS_T;
+
 /*****************************************************************************/
 /* Public functions.  Declare as extern.                                     */
 /*****************************************************************************/
 
 extern int stui_server( void );
+extern void stui_set_frame_interval( unsigned int );
+extern void stui_set_async( int );
+extern void stui_set_notify( STUI_NOTIFY_T );
+extern void stui_get_screen_size( unsigned int *, unsigned int * );
+
+extern void stui_begin_update( void );
+extern void stui_end_update( void );
+
+extern int stui_trace_start( const char * );
+extern void stui_trace_stop( void );
+
+extern STUI_CONTEXT_T stui_context_open( const char * );
+extern STUI_CONTEXT_T stui_context_open_driver( const char *, const char * );
+extern void stui_context_close( STUI_CONTEXT_T );
+extern STUI_CONTEXT_T stui_context_default( void );
+extern void * stui_context_get_driver( STUI_CONTEXT_T );
+extern STUI_CONTEXT_T stui_window_context( STUI_WINDOW_T );
+extern void stui_context_set_frame_interval( STUI_CONTEXT_T, unsigned int );
+extern void stui_context_set_async( STUI_CONTEXT_T, int );
+extern void stui_context_set_notify( STUI_CONTEXT_T, STUI_NOTIFY_T );
+extern void stui_context_get_screen_size( STUI_CONTEXT_T, unsigned int *, unsigned int * );
+extern void stui_context_begin_update( STUI_CONTEXT_T );
+extern void stui_context_end_update( STUI_CONTEXT_T );
+extern STUI_WINDOW_T stui_context_create_window( STUI_CONTEXT_T, STUI_CALLBACK_T, unsigned int );
+extern STUI_WINDOW_T stui_context_window_at( STUI_CONTEXT_T, unsigned int, unsigned int );
+extern void stui_context_get_stats( STUI_CONTEXT_T, STUI_STATS_T * );
+extern void stui_get_stats( STUI_STATS_T * );
+extern void stui_context_set_hud( STUI_CONTEXT_T, int );
+extern void stui_set_hud( int );
 
 extern STUI_WINDOW_T stui_create_window( STUI_CALLBACK_T );
+extern STUI_WINDOW_T stui_create_window_ex( STUI_CALLBACK_T, unsigned int );
 extern void stui_destroy_window( STUI_WINDOW_T );
 
 extern void stui_move_window( STUI_WINDOW_T, unsigned int, unsigned int );
@@ -114,14 +198,22 @@ extern void stui_hide_window( STUI_WINDOW_T );
 
 extern void stui_raise_window( STUI_WINDOW_T );
 
+extern STUI_WINDOW_T stui_window_at( unsigned int, unsigned int );
+
 extern void stui_set_userdata( STUI_WINDOW_T, void * );
 extern void * stui_get_userdata( STUI_WINDOW_T );
 
 extern void stui_get_window_dims( STUI_WINDOW_T, unsigned int *, unsigned int * );
+extern void stui_get_window_stats( STUI_WINDOW_T, unsigned long *, unsigned long * );
 
 extern void stui_repaint( STUI_WINDOW_T );
+extern void stui_scroll_window( STUI_WINDOW_T, int );
 
 extern void stui_cb_putchar( STUI_WINDOW_T, unsigned int, unsigned int, STUI_CHAR_T );
+extern void stui_cb_write_span( STUI_WINDOW_T, unsigned int, unsigned int, const STUI_CHAR_T *, unsigned int );
+extern void stui_cb_write_text( STUI_WINDOW_T, unsigned int, unsigned int, STUI_CHAR_T, const char * );
+extern void stui_cb_fill_rect( STUI_WINDOW_T, unsigned int, unsigned int, unsigned int, unsigned int, STUI_CHAR_T );
+extern void stui_cb_blit( STUI_WINDOW_T, unsigned int, unsigned int, unsigned int, unsigned int, const STUI_CHAR_T *, unsigned int );
 
 #if defined( STUI_USE_FORMAT )
 extern void stui_cb_printf( STUI_WINDOW_T, unsigned int, unsigned int, STUI_CHAR_T, const char *, ... );
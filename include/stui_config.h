@@ -35,5 +35,37 @@
 /* Use format for output formatting */
 #define STUI_USE_FORMAT
 
+/* Maximum number of separate damage rectangles tracked per window.  Further
+   damage is merged into the existing rectangles. */
+#define STUI_MAX_DAMAGE_RECTS   ( 8 )
+
+/* Default minimum interval between screen updates, in milliseconds.  Can be
+   changed at runtime with stui_set_frame_interval(). */
+#define STUI_FRAME_INTERVAL     ( 20 )
+
+/* Number of window operations that can be queued in asynchronous mode before
+   callers fall back to taking the lock. */
+#define STUI_CMD_QUEUE_LEN      ( 256 )
+
+/* Number of tasks used to paint windows in parallel.  0 paints all windows
+   from the server task.  Callbacks must be safe to run concurrently with
+   each other when this is non-zero. */
+#define STUI_WORKER_TASKS       ( 0 )
+
+/* Number of drivers that can be registered, including the built-in ones. */
+#define STUI_MAX_DRIVERS        ( 8 )
+
+/* Performance overlay: the minimum interval between updates, in
+   milliseconds, the number of recent frames the frame time percentiles are
+   taken over, and the number of slowest windows listed. */
+#define STUI_HUD_INTERVAL       ( 500 )
+#define STUI_HUD_FRAMES         ( 128 )
+#define STUI_HUD_TOP            ( 4 )
+
+/* One in this many holds of a context's lock is timed for the statistics,
+   so that the clock is not read on every call.  Every hold is timed while
+   the performance overlay is shown. */
+#define STUI_LOCK_SAMPLE        ( 16 )
+
 
 #endif /* STUI_CONFIG_H */
@@ -35,6 +35,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 
 /*****************************************************************************/
 /* Project Includes                                                          */
@@ -48,24 +52,78 @@
 /* Macros, constants                                                         */
 /*****************************************************************************/
 
+/** A cell value that no window can produce, used to force cells to be sent **/
+#define INVALID_CELL    ( (STUI_CHAR_T)~0 )
+
+/** Minimum number of rows that must match before scrolling the terminal **/
+#define MIN_SCROLL_ROWS ( 3 )
+
+/** Size of the performance overlay, in cells.  Its text is indented by one
+    cell, so each line holds at most HUD_COLS - 1 characters. **/
+#define HUD_COLS        ( 40 )
+#define HUD_ROWS        ( 3 + STUI_HUD_TOP )
+
+/** Size of the tiles of the window index, in cells **/
+#define TILE_ROWS       ( 8 )
+#define TILE_COLS       ( 16 )
 
 /*****************************************************************************/
 /* Data types                                                                */
 /*****************************************************************************/
 
 /**
-   A visual represents the physical visual interface.  All it needs are the
-   visual buffer vbuf and the dimensions of the screen.
+   A visual represents the physical visual interface.  Windows are painted
+   into the back buffer vbuf, while the front buffer fbuf holds what was last
+   sent to the driver.  Only the differences between the two are presented,
+   described by the runs array.  The row hashes bhash and fhash are used to
+   spot rows that have moved between the two buffers.
+   
+   owner records which window is visible in each cell, or NULL if no window
+   covers it.  Windows only ever write to the cells they own.  otmp is
+   working storage used when the owners are recomputed.
 **/
 struct visual {
     STUI_CHAR_T *vbuf;
+    STUI_CHAR_T *fbuf;
+    struct drv_run *runs;
+    unsigned long *bhash, *fhash;
+    struct window **owner, **otmp;
     unsigned int width, height;
 };
 
+/**
+   Rectangles are held in screen coordinates.  The bottom and right edges are
+   exclusive, so a rectangle is empty if top >= bottom or left >= right.
+**/
+struct rect {
+    unsigned int top, left;
+    unsigned int bottom, right;
+};
+
+/**
+   The screen is divided into tiles of TILE_ROWS by TILE_COLS cells, each of
+   which lists the visible windows that overlap it, bottom window first.
+   Finding the windows in an area of the screen then only involves the
+   windows nearby, however many windows there are.
+**/
+struct tile {
+    struct window **wins;
+    unsigned int n, size;
+};
+
+struct grid {
+    struct tile *tiles;
+    unsigned int rows, cols;
+};
+
 /**
    Internal window data type.
 **/
 struct window {
+    /* The context the window belongs to, and the window's number in it */
+    struct stui_context *ctx;
+    unsigned int id;
+    
     /* Window dimensions */
     unsigned int width, height;
     unsigned int row, col;
@@ -76,64 +134,318 @@ struct window {
     /* List pointers */
     struct window *up, *down;
     
+    /* Stacking order, higher is nearer the top */
+    long z;
+    
     /* Window properties */
     struct {
         unsigned int visible:1;
-        unsigned int dirty:1;
+        unsigned int retained:1;
+        
+        /* Set if the width or height was given as 0, so the window extends
+           to the edge of the screen however big the screen is */
+        unsigned int auto_width:1;
+        unsigned int auto_height:1;
     } flag;
     
+    /* The window as it is being painted.  The application may change the
+       window at any time, and the server catches up at the start of each
+       frame, so that callbacks can run without holding the lock.
+    */
+    struct {
+        unsigned int width, height;
+        unsigned int row, col;
+        long z;
+        int visible;
+        
+        /* Work for the current frame: the part of bbuf to regenerate, in
+           window coordinates, and the damage to paint onto the screen */
+        struct rect regen;
+        struct rect damage[STUI_MAX_DAMAGE_RECTS];
+        unsigned int n_damage;
+        
+        /* The region being repainted by the callback.  Any output outside
+           of clip, or to cells the window does not own, is discarded.  For
+           retained windows it is the part of bbuf being regenerated, in
+           window coordinates, otherwise it is in screen coordinates. */
+        struct rect clip;
+        
+        /* Set if anything was painted in the current frame */
+        int painted;
+        
+        /* Callbacks made in the current frame, and the time they took */
+        unsigned long calls, us;
+    } paint;
+    
+    /* Area of the screen the window is listed under in the grid, empty if
+       it is not listed */
+    struct rect indexed;
+    
+    /* Rows to scroll the window contents by at the next refresh */
+    int scroll;
+    
+    /* Retained windows keep their contents in their own buffer, bbuf, which
+       is composited onto the screen without calling back into the
+       application.  The callback is only called to fill in the invalid
+       region, given in window coordinates.  bbuf is NULL for windows that
+       paint straight onto the screen.
+    */
+    STUI_CHAR_T *bbuf;
+    struct rect invalid;
+    
+    /* Damaged regions awaiting repaint.  The window is dirty if n_damage is
+       non-zero. */
+    struct rect damage[STUI_MAX_DAMAGE_RECTS];
+    unsigned int n_damage;
+    
+    /* Callbacks made in all, and the time they took in microseconds, and
+       both as they were when the performance overlay was last updated */
+    unsigned long calls, us;
+    unsigned long hud_calls, hud_us;
+    
     /* Other */
     void * userdata;
 };
 
+/**
+   A span of cells on one row of a window, as written by a callback, once
+   clipped.  dst points to the first of the n cells to write, which is skip
+   cells into the span as given.  For windows painting straight onto the
+   screen own points to the owners of those cells, otherwise it is NULL.
+**/
+struct span {
+    STUI_CHAR_T *dst;
+    struct window **own;
+    unsigned int skip, n;
+};
+
+/**
+   Window operations, either carried out straight away or queued for the
+   server when in asynchronous mode.
+**/
+enum {
+    CMD_DESTROY,
+    CMD_SHOW,
+    CMD_HIDE,
+    CMD_MOVE,
+    CMD_RESIZE,
+    CMD_RAISE,
+    CMD_REPAINT,
+    CMD_SCROLL
+};
+
+struct command {
+    int op;
+    struct window *win;
+    unsigned int a, b;
+};
+
+/**
+   A context is one terminal and the windows shown on it.  Each context has
+   its own lock, so work on one terminal never holds up another, while the
+   server task and any worker tasks are shared by all the contexts.
+**/
+struct stui_context {
+    /* Number of the context, and of the last window created in it */
+    unsigned int id;
+    unsigned int last_win_id;
+    
+    /* The terminal, and the driver for it */
+    DRV_T drv;
+    const struct drv_ops *ops;
+    struct visual vis;
+    
+    /* Index of visible windows by screen position */
+    struct grid grid;
+    
+    /* Set when windows have been shown, hidden, moved, resized, raised or
+       destroyed since the owners of the cells were last brought up to date,
+       so that the owners cannot be trusted to find the window at a position */
+    int owners_stale;
+    
+    /*
+       Windows are stored in a linked list, with root pointing to the bottom
+       of the stack of windows.  I.e.:
+       
+                  /-----------------/   ---- GLASS ----
+                 /                 /
+                /                 /
+               /                 /--/
+              /                 /  /
+             /_________________/  /
+               /                 /--/
+              /                 /  /
+             /_________________/  /
+               /                 /--/
+              /                 /  /
+             /_________________/  /
+               /                 /--/
+              /                 /  /
+             /_________________/  /
+               /                 /
+              /                 /
+      root-> /_________________/
+        
+       
+       Redrawing then naturally starts at the bottom and works its way up the 
+       stack, to top.
+    */
+    struct window *root, *top;
+    
+    /* Destroyed windows waiting for the server to let go of them, linked by
+       their up pointers */
+    struct window *zombies;
+    
+    /* Stacking order of the top and bottom windows */
+    long z_top, z_bottom;
+    
+    /* Lock on the context's data.  lock_timed is set while the current hold
+       of the lock is being timed for the statistics, and lock_time is when
+       it was taken. */
+    osal_mutex_t svr_lock;
+    int lock_timed;
+    unsigned int lock_time;
+    
+    /* Set when the server has been woken for the context.  It is set at most
+       once per frame, when the context first needs the server, so the
+       server's semaphore is not released over and over. */
+    int wake_pending;
+    
+    /* Set when the context needs a frame, cleared by the server as it starts
+       drawing one */
+    volatile int signalled;
+    
+    /* Nesting depth of stui_begin_update() calls.  No frames are drawn while
+       it is non-zero. */
+    unsigned int update_depth;
+    
+    /* In asynchronous mode window operations are queued on cmd_queue
+       instead of taking the lock, and the server carries them out at the
+       start of the next frame.  cmd_pending is set when the server has been
+       woken for them. */
+    osal_queue_t cmd_queue;
+    volatile int async_mode;
+    volatile int cmd_pending;
+    
+    /* Minimum time between frames, in milliseconds, and when the last frame
+       finished, in microseconds */
+    unsigned int frame_interval;
+    unsigned int last_frame;
+    
+    /* Set when cells have been cleared, so the screen needs presenting even
+       if no window was painted */
+    int screen_dirty;
+    
+    /* Set when the terminal may have been resized */
+    volatile int check_size;
+    
+    /* Set if the server has been woken since the last frame, and when it
+       was first woken, and the statistics, which are kept under the lock */
+    int dirty;
+    unsigned int dirty_since;
+    STUI_STATS_T stats;
+    
+    /* How long the last STUI_HUD_FRAMES frames took, indexed by the frame
+       number, which are kept whether or not the overlay is shown */
+    unsigned int frame_times[STUI_HUD_FRAMES];
+    
+    /* The performance overlay, or NULL if it is not shown, with its text,
+       when it was last updated and the statistics then */
+    struct window *hud;
+    char hud_text[HUD_ROWS][HUD_COLS];
+    unsigned int hud_time;
+    STUI_STATS_T hud_stats;
+    
+    /* Application function told about changes to the terminal */
+    STUI_NOTIFY_T notify;
+    
+    /* List of all contexts */
+    struct stui_context *next;
+};
+
 /*****************************************************************************/
 /* Private Data.  Declare as static.                                         */
 /*****************************************************************************/
 
-/** Assume a single visual **/
-static struct visual vis = { NULL, 0, 0 };
+/** All the open contexts, and the lock on the list.  The server holds the
+    lock while it serves the contexts, so a context is never closed while
+    the server is using it.
+**/
+static struct stui_context *contexts = NULL;
+static osal_mutex_t ctx_lock;
 
-/**
-   Windows are stored in a linked list, with root pointing to the bottom of the
-   stack of windows.  I.e.:
-   
-              /-----------------/   ---- GLASS ----
-             /                 /
-            /                 /
-           /                 /--/
-          /                 /  /
-         /_________________/  /
-           /                 /--/
-          /                 /  /
-         /_________________/  /
-           /                 /--/
-          /                 /  /
-         /_________________/  /
-           /                 /--/
-          /                 /  /
-         /_________________/  /
-           /                 /
-          /                 /
-  root-> /_________________/
-    
-   
-   Redrawing then naturally starts at the bottom and works its way up the 
-   stack.     
-**/   
-static struct window *root = NULL;
+/** The context opened by stui_server(), used by the functions that do not
+    take a context **/
+static struct stui_context *default_ctx = NULL;
 
-/** Global lock on the internal data **/
-static osal_mutex_t svr_lock;
+/** Set once the server task and the things shared by all contexts have been
+    set up **/
+static int svr_running = 0;
 
 /** The server task is started up at initialisation time.  Its main job is to
-    kick off visual refreshes at timed intervals.
+    kick off visual refreshes when windows are dirtied, no more often than
+    once every frame_interval milliseconds for each context.
 **/
 static osal_task_t serverTCB;
 
+/** Semaphore used to wake the server task, released when any context needs
+    it.
+**/
+static osal_sem_t svr_wake;
+
+/** Set by the driver when a terminal has been resized.  The driver may set
+    it from a signal handler.
+**/
+static volatile sig_atomic_t resize_pending = 0;
+
+/** Windows with work to do in the current frame, taken from the windows while
+    holding the lock and then carried out without it.
+**/
+static struct window **work = NULL;
+static unsigned int n_work = 0, work_size = 0;
+
+/** API call trace.  When tracing, each call that changes the windows is
+    written to trace_fp as a line of text, see stui_trace_start().
+**/
+static FILE * volatile trace_fp = NULL;
+static osal_mutex_t trace_lock;
+static int trace_lock_ready = 0;
+static unsigned int trace_start_time;
+
+/** Number of the last context opened **/
+static unsigned int last_ctx_id = 0;
+
+/** Names of window operations in the trace **/
+static const char * const cmd_names[] = {
+    "destroy_window",
+    "show_window",
+    "hide_window",
+    "move_window",
+    "resize_window",
+    "raise_window",
+    "repaint",
+    "scroll_window"
+};
+
+#if STUI_WORKER_TASKS > 0
+/** Pool of tasks that paint windows in parallel.  Windows are handed out on
+    work_queue, and work_done is released as each one is finished.
+**/
+static osal_task_t workerTCB[STUI_WORKER_TASKS];
+static osal_queue_t work_queue;
+static osal_sem_t work_done;
+#endif
+
 /*****************************************************************************/
 /* Private function prototypes.  Declare as static.                          */
 /*****************************************************************************/
 
+static void kick_server( struct stui_context * );
+static void drain_commands( struct stui_context * );
+static int resize_visual( struct stui_context * );
+static void raise_window( struct window * );
+static void redim_window( struct window *, unsigned int, unsigned int,
+                          unsigned int, unsigned int );
 
 /*****************************************************************************/
 /* Private functions.  Declare as static.                                    */
@@ -141,205 +453,2774 @@ static osal_task_t serverTCB;
 
 /*****************************************************************************/
 /**
-    Server task
+    Write a line to the API call trace, if tracing, prefixed by the time in
+    microseconds since tracing started.
+**/
+static void trace( const char *fmt, ... )
+{
+    unsigned int now;
+    va_list ap;
+    
+    if ( !trace_fp || osal_mutex_obtain( &trace_lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    if ( trace_fp )
+    {
+        osal_get_systime( NULL, &now );
+        fprintf( trace_fp, "%u ", now - trace_start_time );
+        
+        va_start( ap, fmt );
+        vfprintf( trace_fp, fmt, ap );
+        va_end( ap );
+        
+        fputc( '\n', trace_fp );
+    }
+    
+    osal_mutex_release( &trace_lock );
+}
+
+/*****************************************************************************/
+/**
+    Compute the intersection of two rectangles.
+    
+    @return non-zero if the intersection is not empty.
+**/
+static int rect_intersect( struct rect *dst, 
+                           const struct rect *a, const struct rect *b )
+{
+    dst->top    = MAX( a->top,    b->top    );
+    dst->left   = MAX( a->left,   b->left   );
+    dst->bottom = MIN( a->bottom, b->bottom );
+    dst->right  = MIN( a->right,  b->right  );
+    
+    return dst->top < dst->bottom && dst->left < dst->right;
+}
+
+/*****************************************************************************/
+/**
+    Compute the bounding box of two rectangles.
+**/
+static void rect_union( struct rect *dst, 
+                        const struct rect *a, const struct rect *b )
+{
+    dst->top    = MIN( a->top,    b->top    );
+    dst->left   = MIN( a->left,   b->left   );
+    dst->bottom = MAX( a->bottom, b->bottom );
+    dst->right  = MAX( a->right,  b->right  );
+}
+
+/*****************************************************************************/
+/**
+    Number of cells covered by a rectangle.
+**/
+static unsigned long rect_area( const struct rect *r )
+{
+    return (unsigned long)( r->bottom - r->top ) * ( r->right - r->left );
+}
+
+/*****************************************************************************/
+/**
+    Get the on-screen area covered by a window as it is painted, clipped to
+    the visual.
+**/
+static void window_rect( const struct window *win, struct rect *r )
+{
+    const struct stui_context *ctx = win->ctx;
+    
+    r->top    = MIN( win->paint.row, ctx->vis.height );
+    r->left   = MIN( win->paint.col, ctx->vis.width  );
+    r->bottom = MIN( win->paint.row + win->paint.height, ctx->vis.height );
+    r->right  = MIN( win->paint.col + win->paint.width,  ctx->vis.width  );
+}
+
+/*****************************************************************************/
+/**
+    Take a context's lock, keeping count of how often it has to be waited for
+    and how long for.  The clock is only read when the lock is contended, or
+    when the hold is to be timed, which is one lock in every STUI_LOCK_SAMPLE,
+    or every lock while the performance overlay is shown.
+    
+    @return 0 if successful.
+**/
+static int lock_ctx( struct stui_context *ctx )
+{
+    unsigned int start, now = 0;
+    int waited = 0;
+    
+    if ( osal_mutex_obtain( &ctx->svr_lock, OSAL_SUSPEND_NEVER ) )
+    {
+        osal_get_systime( NULL, &start );
+        if ( osal_mutex_obtain( &ctx->svr_lock, OSAL_SUSPEND_FOREVER ) )
+            return -1;
+        osal_get_systime( NULL, &now );
+        
+        ctx->stats.lock_waits++;
+        ctx->stats.lock_wait_us += now - start;
+        waited = 1;
+    }
+    
+    ctx->stats.locks++;
+    ctx->lock_timed = ctx->hud || !( ctx->stats.locks % STUI_LOCK_SAMPLE );
+    if ( ctx->lock_timed )
+    {
+        if ( !waited )
+            osal_get_systime( NULL, &now );
+        ctx->lock_time = now;
+    }
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+    Release a context's lock, keeping count of how long it was held if the
+    hold is being timed.
+**/
+static void unlock_ctx( struct stui_context *ctx )
+{
+    unsigned int now, held;
+    
+    if ( ctx->lock_timed )
+    {
+        osal_get_systime( NULL, &now );
+        held = now - ctx->lock_time;
+        ctx->stats.locks_timed++;
+        ctx->stats.lock_hold_us += held;
+        if ( held > ctx->stats.lock_hold_max_us )
+            ctx->stats.lock_hold_max_us = held;
+    }
+    
+    osal_mutex_release( &ctx->svr_lock );
+}
+
+/*****************************************************************************/
+/**
+    Wake the server to draw a frame for a context.
+**/
+static void wake_server( struct stui_context *ctx )
+{
+    if ( !ctx->dirty )
+    {
+        ctx->dirty = 1;
+        osal_get_systime( NULL, &ctx->dirty_since );
+    }
+    
+    ctx->signalled = 1;
+    osal_sem_release( &svr_wake );
+}
+
+/*****************************************************************************/
+/**
+    Let the server know there is work to do.
+**/
+static void kick_server( struct stui_context *ctx )
+{
+    if ( !ctx->wake_pending )
+    {
+        ctx->wake_pending = 1;
+        wake_server( ctx );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Add a damaged region to a window.  The region is clipped to the window.
+    
+    Damage is merged into an existing rectangle if that does not grow the
+    total area to be repainted.  Otherwise it is added as a new rectangle, or
+    if the window already holds STUI_MAX_DAMAGE_RECTS rectangles, merged into
+    the one that grows the least.
+**/
+static void add_damage( struct window *win, const struct rect *r )
+{
+    struct rect wr, nr, u;
+    unsigned long growth, best_growth = ULONG_MAX;
+    unsigned int i, best = 0;
+    
+    window_rect( win, &wr );
+    if ( !rect_intersect( &nr, r, &wr ) )
+        return;
+    
+    for ( i = 0; i < win->n_damage; i++ )
+    {
+        rect_union( &u, &win->damage[i], &nr );
+        if ( rect_area( &u ) <= rect_area( &win->damage[i] ) + rect_area( &nr ) )
+        {
+            win->damage[i] = u;
+            return;
+        }
+        
+        growth = rect_area( &u ) - rect_area( &win->damage[i] );
+        if ( growth < best_growth )
+        {
+            best_growth = growth;
+            best        = i;
+        }
+    }
+    
+    if ( win->n_damage < STUI_MAX_DAMAGE_RECTS )
+        win->damage[win->n_damage++] = nr;
+    else
+        rect_union( &win->damage[best], &win->damage[best], &nr );
+    
+    kick_server( win->ctx );
+}
+
+/*****************************************************************************/
+/**
+    Get the range of tiles covering a rectangle.  The bottom and right edges
+    are exclusive.
+**/
+static void tile_span( const struct rect *r, struct rect *t )
+{
+    t->top    = r->top  / TILE_ROWS;
+    t->left   = r->left / TILE_COLS;
+    t->bottom = ( r->bottom + TILE_ROWS - 1 ) / TILE_ROWS;
+    t->right  = ( r->right  + TILE_COLS - 1 ) / TILE_COLS;
+}
+
+/*****************************************************************************/
+/**
+    Take a window out of the grid.
+**/
+static void grid_remove( struct window *win )
+{
+    struct stui_context *ctx = win->ctx;
+    struct rect t;
+    unsigned int row, col, i;
+    
+    tile_span( &win->indexed, &t );
+    for ( row = t.top; row < t.bottom; row++ )
+    {
+        for ( col = t.left; col < t.right; col++ )
+        {
+            struct tile *tile = &ctx->grid.tiles[ ( row * ctx->grid.cols ) + col ];
+            
+            for ( i = 0; i < tile->n; i++ )
+            {
+                if ( tile->wins[i] == win )
+                {
+                    memmove( &tile->wins[i], &tile->wins[i + 1], 
+                             ( tile->n - i - 1 ) * sizeof(tile->wins[0]) );
+                    tile->n--;
+                    break;
+                }
+            }
+        }
+    }
+    
+    win->indexed.top = win->indexed.bottom = 0;
+}
+
+/*****************************************************************************/
+/**
+    Add a visible window to the grid at its current position, keeping each
+    tile's list in stacking order.  If a tile cannot grow the window is left
+    out of it, so at worst part of the window is not shown.
+**/
+static void grid_insert( struct window *win )
+{
+    struct stui_context *ctx = win->ctx;
+    struct rect t;
+    unsigned int row, col, i;
+    
+    window_rect( win, &win->indexed );
+    tile_span( &win->indexed, &t );
+    for ( row = t.top; row < t.bottom; row++ )
+    {
+        for ( col = t.left; col < t.right; col++ )
+        {
+            struct tile *tile = &ctx->grid.tiles[ ( row * ctx->grid.cols ) + col ];
+            
+            if ( tile->n == tile->size )
+            {
+                unsigned int size = tile->size ? tile->size * 2 : 4;
+                struct window **p = realloc( tile->wins, size * sizeof(*p) );
+                
+                if ( !p )
+                    continue;
+                
+                tile->wins = p;
+                tile->size = size;
+            }
+            
+            for ( i = tile->n; i > 0 && tile->wins[i - 1]->paint.z > win->paint.z; i-- )
+                tile->wins[i] = tile->wins[i - 1];
+            
+            tile->wins[i] = win;
+            tile->n++;
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+    Move a window to the top of each of the tiles it is listed in.
+**/
+static void grid_raise( struct window *win )
+{
+    struct stui_context *ctx = win->ctx;
+    struct rect t;
+    unsigned int row, col, i;
+    
+    tile_span( &win->indexed, &t );
+    for ( row = t.top; row < t.bottom; row++ )
+    {
+        for ( col = t.left; col < t.right; col++ )
+        {
+            struct tile *tile = &ctx->grid.tiles[ ( row * ctx->grid.cols ) + col ];
+            
+            for ( i = 0; i < tile->n; i++ )
+            {
+                if ( tile->wins[i] == win )
+                {
+                    memmove( &tile->wins[i], &tile->wins[i + 1], 
+                             ( tile->n - i - 1 ) * sizeof(tile->wins[0]) );
+                    tile->wins[tile->n - 1] = win;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+    Recompute which window owns each cell in region r of the screen, after
+    windows have been shown, hidden, moved, resized or raised.  Cells that
+    change hands are damaged in their new owner, and cells no longer covered
+    by any window are cleared.
+**/
+static void update_owners( struct stui_context *ctx, const struct rect *r )
+{
+    struct window *win;
+    struct rect t, x;
+    unsigned int row, col, start, trow, tcol;
+    
+    /* Work out the new owners a tile at a time, bottom window first */
+    tile_span( r, &t );
+    for ( trow = t.top; trow < t.bottom; trow++ )
+    {
+        for ( tcol = t.left; tcol < t.right; tcol++ )
+        {
+            const struct tile *tile = &ctx->grid.tiles[ ( trow * ctx->grid.cols ) + tcol ];
+            struct rect tr;
+            unsigned int i;
+            
+            tr.top    = trow * TILE_ROWS;
+            tr.left   = tcol * TILE_COLS;
+            tr.bottom = tr.top  + TILE_ROWS;
+            tr.right  = tr.left + TILE_COLS;
+            if ( !rect_intersect( &tr, &tr, r ) )
+                continue;
+            
+            for ( row = tr.top; row < tr.bottom; row++ )
+                for ( col = tr.left; col < tr.right; col++ )
+                    ctx->vis.otmp[ ( row * ctx->vis.width ) + col ] = NULL;
+            
+            for ( i = 0; i < tile->n; i++ )
+            {
+                if ( !rect_intersect( &x, &tile->wins[i]->indexed, &tr ) )
+                    continue;
+                
+                for ( row = x.top; row < x.bottom; row++ )
+                    for ( col = x.left; col < x.right; col++ )
+                        ctx->vis.otmp[ ( row * ctx->vis.width ) + col ] = tile->wins[i];
+            }
+        }
+    }
+    
+    /* Damage each run of cells with a new owner */
+    for ( row = r->top; row < r->bottom; row++ )
+    {
+        struct window **cur  = ctx->vis.owner + ( row * ctx->vis.width );
+        struct window **next = ctx->vis.otmp  + ( row * ctx->vis.width );
+        
+        col = r->left;
+        while ( col < r->right )
+        {
+            if ( cur[col] == next[col] )
+            {
+                col++;
+                continue;
+            }
+            
+            win   = next[col];
+            start = col;
+            while ( col < r->right && cur[col] != next[col] && next[col] == win )
+            {
+                cur[col] = win;
+                if ( !win )
+                    ctx->vis.vbuf[ ( row * ctx->vis.width ) + col ] = ' ';
+                col++;
+            }
+            
+            if ( win )
+            {
+                x.top    = row;
+                x.bottom = row + 1;
+                x.left   = start;
+                x.right  = col;
+                add_damage( win, &x );
+            }
+            else
+            {
+                ctx->screen_dirty = 1;
+                kick_server( ctx );
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+    Shrink a region of the screen to the bounding box of the cells in it that
+    are owned by a window.
+    
+    @return 0 if the window owns none of the cells.
+**/
+static int clip_to_owned( const struct window *win, struct rect *r )
+{
+    const struct stui_context *ctx = win->ctx;
+    struct rect b = { UINT_MAX, UINT_MAX, 0, 0 };
+    unsigned int row, col;
+    
+    for ( row = r->top; row < r->bottom; row++ )
+    {
+        struct window **own = ctx->vis.owner + ( row * ctx->vis.width );
+        
+        for ( col = r->left; col < r->right; col++ )
+        {
+            if ( own[col] != win )
+                continue;
+            
+            b.top    = MIN( b.top,    row     );
+            b.left   = MIN( b.left,   col     );
+            b.bottom = MAX( b.bottom, row + 1 );
+            b.right  = MAX( b.right,  col + 1 );
+        }
+    }
+    
+    *r = b;
+    return b.top < b.bottom;
+}
+
+/*****************************************************************************/
+/**
+    Mark an entire window as damaged.
+**/
+static void damage_window( struct window *win )
+{
+    struct rect r;
+    
+    window_rect( win, &r );
+    add_damage( win, &r );
+}
+
+/*****************************************************************************/
+/**
+    Mark part of a retained window's contents as needing to be regenerated by
+    its callback.  The region is in window coordinates.
+**/
+static void invalidate_backing( struct window *win, const struct rect *r )
+{
+    struct rect wr = { 0, 0, 0, 0 };
+    
+    wr.bottom = win->paint.height;
+    wr.right  = win->paint.width;
+    
+    if ( win->invalid.top < win->invalid.bottom )
+        rect_union( &win->invalid, &win->invalid, r );
+    else
+        win->invalid = *r;
+    
+    if ( !rect_intersect( &win->invalid, &win->invalid, &wr ) )
+        win->invalid.top = win->invalid.bottom = 0;
+}
+
+/*****************************************************************************/
+/**
+    Reallocate the backing buffer of a retained window for a new size.  The
+    contents are lost, so the whole window is invalidated.  If there is not
+    enough memory the window reverts to painting straight onto the screen.
+**/
+static void resize_backing( struct window *win, 
+                            unsigned int width, unsigned int height )
+{
+    STUI_CHAR_T *p;
+    unsigned int i;
+    
+    if ( width == win->paint.width && height == win->paint.height && win->bbuf )
+        return;
+    
+    p = realloc( win->bbuf, ( width * height + 1 ) * sizeof(STUI_CHAR_T) );
+    if ( !p )
+    {
+        free( win->bbuf );
+        win->bbuf = NULL;
+        return;
+    }
+    
+    for ( i = 0; i < width * height; i++ )
+        p[i] = ' ';
+    
+    win->bbuf           = p;
+    win->invalid.top    = 0;
+    win->invalid.left   = 0;
+    win->invalid.bottom = height;
+    win->invalid.right  = width;
+}
+
+/*****************************************************************************/
+/**
+    Scroll the backing buffer of a retained window, invalidating the rows
+    scrolled into view.
+**/
+static void scroll_backing( struct window *win, int n )
+{
+    struct rect r = { 0, 0, 0, 0 };
+    size_t row_size = win->paint.width * sizeof(STUI_CHAR_T);
+    unsigned int m = (unsigned int)ABS( n );
+    
+    r.right  = win->paint.width;
+    r.bottom = win->paint.height;
+    
+    if ( m < win->paint.height )
+    {
+        if ( n > 0 )
+        {
+            memmove( win->bbuf, win->bbuf + ( m * win->paint.width ), 
+                     ( win->paint.height - m ) * row_size );
+            r.top = win->paint.height - m;
+        }
+        else
+        {
+            memmove( win->bbuf + ( m * win->paint.width ), win->bbuf,
+                     ( win->paint.height - m ) * row_size );
+            r.bottom = m;
+        }
+        
+        /* Existing invalid region moves with the contents */
+        if ( win->invalid.top < win->invalid.bottom )
+        {
+            win->invalid.top    = (unsigned int)MAX( (int)win->invalid.top    - n, 0 );
+            win->invalid.bottom = (unsigned int)MAX( (int)win->invalid.bottom - n, 0 );
+        }
+    }
+    
+    invalidate_backing( win, &r );
+}
+
+/*****************************************************************************/
+/**
+    Copy part of a retained window's contents onto the cells of the screen it
+    owns.  The region is in screen coordinates and lies within the window.
+**/
+static void blit_backing( struct window *win, const struct rect *r )
+{
+    struct stui_context *ctx = win->ctx;
+    unsigned int row, col;
+    
+    for ( row = r->top; row < r->bottom; row++ )
+    {
+        struct window **own = ctx->vis.owner + ( row * ctx->vis.width );
+        STUI_CHAR_T *dst = ctx->vis.vbuf + ( row * ctx->vis.width );
+        const STUI_CHAR_T *src = win->bbuf 
+                               + ( ( row - win->paint.row ) * win->paint.width )
+                               - win->paint.col;
+        
+        for ( col = r->left; col < r->right; col++ )
+            if ( own[col] == win )
+                dst[col] = src[col];
+    }
+}
+
+/*****************************************************************************/
+/**
+    Clip a span of n cells starting at row, col of a window to the region
+    being repainted by its callback.
+    
+    @return Number of cells left to write.
+**/
+static unsigned int clip_span( struct window *win, 
+                               unsigned int row, unsigned int col, 
+                               unsigned int n, struct span *sp )
+{
+    struct stui_context *ctx = win->ctx;
+    const struct rect *clip = &win->paint.clip;
+    
+    if ( row >= win->paint.height || col >= win->paint.width )
+        return 0;
+    
+    n = MIN( n, win->paint.width - col );
+    sp->skip = 0;
+    
+    /* The clip region of a retained window is in window coordinates */
+    if ( !win->bbuf )
+    {
+        row += win->paint.row;
+        col += win->paint.col;
+    }
+    
+    if ( row < clip->top || row >= clip->bottom || col >= clip->right )
+        return 0;
+    
+    if ( col < clip->left )
+    {
+        sp->skip = clip->left - col;
+        if ( sp->skip >= n )
+            return 0;
+        
+        col += sp->skip;
+        n   -= sp->skip;
+    }
+    
+    sp->n = MIN( n, clip->right - col );
+    
+    if ( win->bbuf )
+    {
+        sp->dst = win->bbuf + ( row * win->paint.width ) + col;
+        sp->own = NULL;
+    }
+    else
+    {
+        sp->dst = ctx->vis.vbuf  + ( row * ctx->vis.width ) + col;
+        sp->own = ctx->vis.owner + ( row * ctx->vis.width ) + col;
+    }
+    
+    return sp->n;
+}
+
+/*****************************************************************************/
+/**
+    Find the next run of cells in a clipped span that the window may write
+    to, following on from the run ending at *end.  Start with *end at 0.
+    
+    @return 0 when there are no more runs.
+**/
+static int next_run( const struct span *sp, const struct window *win,
+                     unsigned int *start, unsigned int *end )
+{
+    unsigned int i = *end;
+    
+    if ( !sp->own )
+    {
+        *start = 0;
+        *end   = sp->n;
+        return i == 0;
+    }
+    
+    while ( i < sp->n && sp->own[i] != win )
+        i++;
+    
+    if ( i == sp->n )
+        return 0;
+    
+    *start = i;
+    while ( i < sp->n && sp->own[i] == win )
+        i++;
+    
+    *end = i;
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+    Write an array of n cells to a row of a window from a callback.
+**/
+static void put_span( struct window *win, unsigned int row, unsigned int col,
+                      const STUI_CHAR_T *src, unsigned int n )
+{
+    struct span sp;
+    unsigned int start, end = 0;
+    
+    if ( !clip_span( win, row, col, n, &sp ) )
+        return;
+    
+    src += sp.skip;
+    while ( next_run( &sp, win, &start, &end ) )
+        memcpy( sp.dst + start, src + start, 
+                ( end - start ) * sizeof(STUI_CHAR_T) );
+}
+
+/*****************************************************************************/
+/**
+    Write n copies of a cell to a row of a window from a callback.
+**/
+static void fill_span( struct window *win, unsigned int row, unsigned int col,
+                       STUI_CHAR_T c, unsigned int n )
+{
+    struct span sp;
+    unsigned int i, start, end = 0;
+    
+    if ( !clip_span( win, row, col, n, &sp ) )
+        return;
+    
+    while ( next_run( &sp, win, &start, &end ) )
+        for ( i = start; i < end; i++ )
+            sp.dst[i] = c;
+}
+
+/*****************************************************************************/
+/**
+    Write n characters of text, all with the same attributes, to a row of a
+    window from a callback.
+**/
+static void put_text( struct window *win, unsigned int row, unsigned int col,
+                      STUI_CHAR_T attr, const char *text, unsigned int n )
+{
+    struct span sp;
+    unsigned int i, start, end = 0;
+    
+    if ( !clip_span( win, row, col, n, &sp ) )
+        return;
+    
+    text += sp.skip;
+    while ( next_run( &sp, win, &start, &end ) )
+        for ( i = start; i < end; i++ )
+            sp.dst[i] = (unsigned char)text[i] | attr;
+}
+
+/*****************************************************************************/
+/**
+    Move a rectangle up by n rows (down for negative n), keeping it within
+    the rows of bounds.
+**/
+static void shift_rows( struct rect *r, int n, const struct rect *bounds )
+{
+    int top    = (int)r->top    - n;
+    int bottom = (int)r->bottom - n;
+    
+    r->top    = (unsigned int)MIN( MAX( top,    (int)bounds->top ), (int)bounds->bottom );
+    r->bottom = (unsigned int)MIN( MAX( bottom, (int)bounds->top ), (int)bounds->bottom );
+}
+
+/*****************************************************************************/
+/**
+    Move the contents of a window up (positive n) or down (negative n) in the
+    visual buffer.  Only cells owned by the window are moved, and any cell
+    whose new contents were not on screen is damaged, which includes the rows
+    scrolled in.  Retained windows are simply redrawn from their scrolled
+    backing buffer.
+**/
+static void scroll_window( struct window *win, int n )
+{
+    struct stui_context *ctx = win->ctx;
+    struct rect wr, r, damage[STUI_MAX_DAMAGE_RECTS];
+    unsigned int rows, col, i, nd;
+    
+    window_rect( win, &wr );
+    rows = wr.bottom - wr.top;
+    if ( !rows || wr.left == wr.right )
+        return;
+    
+    if ( win->bbuf )
+    {
+        scroll_backing( win, n );
+        add_damage( win, &wr );
+        return;
+    }
+    
+    /* Any damage moves along with the contents */
+    nd = win->n_damage;
+    memcpy( damage, win->damage, nd * sizeof(damage[0]) );
+    win->n_damage = 0;
+    
+    for ( i = 0; i < rows; i++ )
+    {
+        /* Work away from the rows being scrolled in */
+        unsigned int row = n > 0 ? wr.top + i : wr.bottom - 1 - i;
+        int src = (int)row + n;
+        struct window **own  = ctx->vis.owner + ( row * ctx->vis.width );
+        struct window **sown = NULL;
+        STUI_CHAR_T *dst = ctx->vis.vbuf + ( row * ctx->vis.width );
+        const STUI_CHAR_T *sbuf = NULL;
+        
+        if ( src >= (int)wr.top && src < (int)wr.bottom )
+        {
+            sown = ctx->vis.owner + ( src * ctx->vis.width );
+            sbuf = ctx->vis.vbuf  + ( src * ctx->vis.width );
+        }
+        
+        col = wr.left;
+        while ( col < wr.right )
+        {
+            if ( own[col] != win )
+            {
+                col++;
+                continue;
+            }
+            
+            if ( sown && sown[col] == win )
+            {
+                dst[col] = sbuf[col];
+                col++;
+                continue;
+            }
+            
+            r.top    = row;
+            r.bottom = row + 1;
+            r.left   = col;
+            while ( col < wr.right && own[col] == win 
+                    && !( sown && sown[col] == win ) )
+                col++;
+            r.right  = col;
+            add_damage( win, &r );
+        }
+    }
+    
+    for ( i = 0; i < nd; i++ )
+    {
+        shift_rows( &damage[i], n, &wr );
+        add_damage( win, &damage[i] );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Hash the contents of one row of a buffer.
+**/
+static unsigned long hash_row( const struct stui_context *ctx, 
+                               const STUI_CHAR_T *p )
+{
+    unsigned long h = 2166136261UL;
+    unsigned int i;
+    
+    for ( i = 0; i < ctx->vis.width; i++ )
+        h = ( ( h ^ p[i] ) * 16777619UL ) & 0xFFFFFFFFUL;
+    
+    return h;
+}
+
+/*****************************************************************************/
+/**
+    Check if a row of a buffer contains just one character.  Such rows match
+    all too easily so are no use for spotting moved rows.
+**/
+static int uniform_row( const struct stui_context *ctx, const STUI_CHAR_T *p )
+{
+    unsigned int i;
+    
+    for ( i = 1; i < ctx->vis.width; i++ )
+        if ( p[i] != p[0] )
+            return 0;
+    
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+    Look for a block of rows that have moved up or down between the front and
+    back buffers, and if one is found ask the driver to scroll that part of
+    the screen.  The front buffer is scrolled to match, leaving the cells that
+    are still different to be sent as usual.
+**/
+static void detect_scroll( struct stui_context *ctx )
+{
+    unsigned int i, j, len, rows = ctx->vis.height;
+    unsigned int best_i = 0, best_j = 0, best_len = 0;
+    size_t row_size = ctx->vis.width * sizeof(STUI_CHAR_T);
+    
+    for ( i = 0; i < rows; i++ )
+    {
+        ctx->vis.bhash[i] = hash_row( ctx, ctx->vis.vbuf + ( i * ctx->vis.width ) );
+        ctx->vis.fhash[i] = hash_row( ctx, ctx->vis.fbuf + ( i * ctx->vis.width ) );
+    }
+    
+    for ( i = 0; i < rows; i += len ? len : 1 )
+    {
+        len = 0;
+        if ( ctx->vis.bhash[i] == ctx->vis.fhash[i] 
+            || uniform_row( ctx, ctx->vis.vbuf + ( i * ctx->vis.width ) ) )
+            continue;
+        
+        /* Find the longest block starting at row i that matches a block
+           elsewhere in the front buffer. */
+        for ( j = 0; j < rows; j++ )
+        {
+            unsigned int k;
+            
+            if ( j == i || ctx->vis.fhash[j] != ctx->vis.bhash[i] )
+                continue;
+            
+            for ( k = 0; i + k < rows && j + k < rows; k++ )
+                if ( ctx->vis.bhash[i + k] != ctx->vis.fhash[j + k]
+                    || memcmp( ctx->vis.vbuf + ( ( i + k ) * ctx->vis.width ), 
+                               ctx->vis.fbuf + ( ( j + k ) * ctx->vis.width ), 
+                               row_size ) )
+                    break;
+            
+            if ( k > len )
+                len = k;
+            if ( k > best_len )
+            {
+                best_i   = i;
+                best_j   = j;
+                best_len = k;
+            }
+        }
+    }
+    
+    if ( best_len < MIN_SCROLL_ROWS )
+        return;
+    
+    if ( best_j > best_i )
+    {
+        /* Contents moved up: rows best_i.. came from best_j.. */
+        unsigned int n = best_j - best_i;
+        unsigned int bottom = best_j + best_len;
+        
+        ctx->ops->scroll( ctx->drv, best_i, bottom, (int)n );
+        memmove( ctx->vis.fbuf + ( best_i * ctx->vis.width ), 
+                 ctx->vis.fbuf + ( best_j * ctx->vis.width ), 
+                 ( bottom - best_j ) * row_size );
+        for ( i = ( bottom - n ) * ctx->vis.width; i < bottom * ctx->vis.width; i++ )
+            ctx->vis.fbuf[i] = ' ';
+    }
+    else
+    {
+        /* Contents moved down: rows best_i.. came from best_j.. */
+        unsigned int n = best_i - best_j;
+        unsigned int bottom = best_i + best_len;
+        
+        ctx->ops->scroll( ctx->drv, best_j, bottom, -(int)n );
+        memmove( ctx->vis.fbuf + ( best_i * ctx->vis.width ), 
+                 ctx->vis.fbuf + ( best_j * ctx->vis.width ), 
+                 best_len * row_size );
+        for ( i = best_j * ctx->vis.width; i < best_i * ctx->vis.width; i++ )
+            ctx->vis.fbuf[i] = ' ';
+    }
+}
+
+/*****************************************************************************/
+/**
+    Compare the back buffer against the front buffer, building the list of
+    runs of changed cells and bringing the front buffer up to date.
+    
+    @return Number of runs found.
+**/
+static unsigned int diff_frames( struct stui_context *ctx )
+{
+    unsigned int row, col, start, n = 0;
+    
+    for ( row = 0; row < ctx->vis.height; row++ )
+    {
+        STUI_CHAR_T *back  = ctx->vis.vbuf + ( row * ctx->vis.width );
+        STUI_CHAR_T *front = ctx->vis.fbuf + ( row * ctx->vis.width );
+        
+        col = 0;
+        while ( col < ctx->vis.width )
+        {
+            if ( back[col] == front[col] )
+            {
+                col++;
+                continue;
+            }
+            
+            start = col;
+            while ( col < ctx->vis.width && back[col] != front[col] )
+            {
+                front[col] = back[col];
+                col++;
+            }
+            
+            ctx->vis.runs[n].row = row;
+            ctx->vis.runs[n].col = start;
+            ctx->vis.runs[n].len = col - start;
+            n++;
+        }
+    }
+    
+    return n;
+}
+
+/*****************************************************************************/
+/**
+    Add a window to the work for the current frame.  If the list cannot grow
+    the window is dropped, so at worst it is not repainted.
+**/
+static void work_add( struct window *win )
+{
+    if ( n_work == work_size )
+    {
+        unsigned int size = work_size ? work_size * 2 : 16;
+        struct window **p = realloc( work, size * sizeof(*p) );
+        
+        if ( !p )
+            return;
+        
+        work      = p;
+        work_size = size;
+    }
+    
+    work[n_work++] = win;
+}
+
+/*****************************************************************************/
+/**
+    Bring the painted state of a window up to date with any changes the
+    application has made to it.  The owners of the cells the window covered
+    and now covers are recomputed, and if the window has moved, changed size
+    or been shown it is repainted in full.
+**/
+static void apply_changes( struct window *win )
+{
+    struct stui_context *ctx = win->ctx;
+    struct rect old = win->indexed;
+    int moved, repaint;
+    
+    moved = win->paint.row != win->row || win->paint.col != win->col
+         || win->paint.width != win->width || win->paint.height != win->height;
+    
+    if ( !moved && win->paint.visible == (int)win->flag.visible )
+    {
+        /* Raising a window only changes the owners of the cells it covers */
+        if ( win->paint.z != win->z )
+        {
+            win->paint.z = win->z;
+            if ( win->paint.visible )
+            {
+                grid_raise( win );
+                update_owners( ctx, &win->indexed );
+            }
+        }
+        return;
+    }
+    
+    if ( win->flag.retained )
+        resize_backing( win, win->width, win->height );
+    
+    if ( win->paint.visible )
+        grid_remove( win );
+    
+    /* Any damage held against the old position is now meaningless, and the
+       window is painted in full if it has moved or has just been shown */
+    if ( moved || !win->flag.visible )
+        win->n_damage = 0;
+    
+    repaint = moved || !win->paint.visible;
+    
+    win->paint.row     = win->row;
+    win->paint.col     = win->col;
+    win->paint.width   = win->width;
+    win->paint.height  = win->height;
+    win->paint.z       = win->z;
+    win->paint.visible = win->flag.visible;
+    
+    /* Hand the old area over to whatever was underneath, then take over the
+       new area */
+    if ( win->paint.visible )
+        grid_insert( win );
+    
+    update_owners( ctx, &old );
+    if ( win->paint.visible )
+    {
+        update_owners( ctx, &win->indexed );
+        if ( repaint )
+            damage_window( win );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Free the windows that have been destroyed, exposing whatever was
+    underneath them.
+**/
+static void free_zombies( struct stui_context *ctx )
+{
+    struct window *win;
+    struct rect r;
+    
+    while ( ctx->zombies )
+    {
+        win     = ctx->zombies;
+        ctx->zombies = win->up;
+        
+        if ( win->paint.visible )
+        {
+            r = win->indexed;
+            grid_remove( win );
+            update_owners( ctx, &r );
+        }
+        
+        free( win->bbuf );
+        free( win );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Take the work for the next frame from the windows.  Retained windows with
+    invalid contents are to be regenerated, and the regenerated parts are
+    damaged so they get copied to the screen.
+**/
+static void take_work( struct stui_context *ctx )
+{
+    struct window *win;
+    struct rect r;
+    
+    n_work = 0;
+    
+    for ( win = ctx->root; win; win = win->up )
+    {
+        win->paint.regen.top = win->paint.regen.bottom = 0;
+        win->paint.n_damage  = 0;
+        
+        if ( win->paint.visible && win->bbuf 
+            && win->invalid.top < win->invalid.bottom )
+        {
+            r = win->invalid;
+            win->invalid.top = win->invalid.bottom = 0;
+            win->paint.regen = r;
+            
+            r.top    += win->paint.row;
+            r.bottom += win->paint.row;
+            r.left   += win->paint.col;
+            r.right  += win->paint.col;
+            add_damage( win, &r );
+        }
+        
+        /* The contents are regenerated even if none of the window is on
+           the screen, as it may come into view when the terminal grows */
+        if ( win->paint.visible && ( win->n_damage 
+            || win->paint.regen.top < win->paint.regen.bottom ) )
+        {
+            memcpy( win->paint.damage, win->damage, 
+                    win->n_damage * sizeof(win->damage[0]) );
+            win->paint.n_damage = win->n_damage;
+            work_add( win );
+        }
+        
+        win->n_damage = 0;
+    }
+}
+
+/*****************************************************************************/
+/**
+    Call a window's callback, timing it.
+**/
+static void call_window( struct window *win, 
+                         unsigned int top, unsigned int left,
+                         unsigned int bottom, unsigned int right )
+{
+    unsigned int start, end;
+    
+    osal_get_systime( NULL, &start );
+    win->callback( win, top, left, bottom, right );
+    osal_get_systime( NULL, &end );
+    
+    win->paint.calls++;
+    win->paint.us += end - start;
+}
+
+/*****************************************************************************/
+/**
+    Carry out the work for a window taken by take_work().  The window only
+    writes to the cells it owns, so windows can be painted in any order or at
+    the same time, windows above are never disturbed and damage that is
+    completely covered is skipped.
+**/
+static void paint_window( struct window *win )
+{
+    struct rect *clip = &win->paint.clip;
+    unsigned int i;
+    
+    win->paint.painted = 0;
+    win->paint.calls   = 0;
+    win->paint.us      = 0;
+    
+    if ( win->paint.regen.top < win->paint.regen.bottom )
+    {
+        *clip = win->paint.regen;
+        call_window( win, clip->top, clip->left, clip->bottom, clip->right );
+    }
+    
+    for ( i = 0; i < win->paint.n_damage; i++ )
+    {
+        *clip = win->paint.damage[i];
+        if ( !clip_to_owned( win, clip ) )
+            continue;
+        
+        win->paint.painted = 1;
+        
+        if ( win->bbuf )
+        {
+            blit_backing( win, clip );
+            continue;
+        }
+        
+        call_window( win, clip->top    - win->paint.row,
+                          clip->left   - win->paint.col,
+                          clip->bottom - win->paint.row,
+                          clip->right  - win->paint.col );
+    }
+}
+
+#if STUI_WORKER_TASKS > 0
+/*****************************************************************************/
+/**
+    Worker task
+    
+    Paints the windows handed to it by the server.
+**/
+static void worker_task( osal_task_t *tcb, void * param1, void *param2 )
+{
+    struct window *win;
+    
+    while(1)
+    {
+        if ( !osal_queue_recv_from( &work_queue, &win, OSAL_SUSPEND_FOREVER ) )
+        {
+            paint_window( win );
+            osal_sem_release( &work_done );
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+    Stop and destroy the first n worker tasks.
+**/
+static void stop_workers( unsigned int n )
+{
+    while ( n-- )
+    {
+        osal_task_stop( &workerTCB[n] );
+        osal_task_destroy( &workerTCB[n] );
+    }
+    
+    osal_sem_destroy( &work_done );
+    osal_queue_destroy( &work_queue );
+}
+
+/*****************************************************************************/
+/**
+    Create and start the worker tasks.
+    
+    @return 0 if successful, -1 if failure.
+**/
+static int start_workers( void )
+{
+    unsigned int i;
+    
+    if ( osal_queue_init( &work_queue, STUI_WORKER_TASKS * 4, 
+                          sizeof(struct window *), "stui:workq" ) )
+        return -1;
+    
+    if ( osal_sem_init( &work_done, 0, "stui:workdone" ) )
+    {
+        osal_queue_destroy( &work_queue );
+        return -1;
+    }
+    
+    for ( i = 0; i < STUI_WORKER_TASKS; i++ )
+    {
+        if ( osal_task_init( &workerTCB[i], 0, worker_task, NULL, NULL, 
+                             10, "stui_worker" ) )
+        {
+            stop_workers( i );
+            return -1;
+        }
+        
+        if ( osal_task_start( &workerTCB[i] ) )
+        {
+            osal_task_destroy( &workerTCB[i] );
+            stop_workers( i );
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+#endif
+
+/*****************************************************************************/
+/**
+    Paint all the windows taken by take_work(), sharing them out between the
+    worker tasks if there are any.
+    
+    @return non-zero if anything was painted.
+**/
+static int do_work( void )
+{
+    unsigned int i;
+    int painted = 0;
+    
+#if STUI_WORKER_TASKS > 0
+    if ( n_work > 1 )
+    {
+        for ( i = 0; i < n_work; i++ )
+            osal_queue_send_to( &work_queue, &work[i], OSAL_SUSPEND_FOREVER );
+        
+        for ( i = 0; i < n_work; i++ )
+            osal_sem_obtain( &work_done, OSAL_SUSPEND_FOREVER );
+    }
+    else
+#endif
+    {
+        for ( i = 0; i < n_work; i++ )
+            paint_window( work[i] );
+    }
+    
+    for ( i = 0; i < n_work; i++ )
+        painted |= work[i]->paint.painted;
+    
+    return painted;
+}
+
+/*****************************************************************************/
+/**
+    Add a frame drawn by serve_context( ctx ) to the context's statistics,
+    along with the callbacks made by the windows painted in it.
+    
+    @param ctx       Context.
+    @param start     When the server started drawing the frame.
+    @param since     When the server was first woken for the frame, or NULL
+                     if it was not.
+    @param cells     Number of cells presented, or -1 if nothing was.
+**/
+static void count_frame( struct stui_context *ctx, unsigned int start,
+                         const unsigned int *since, long cells )
+{
+    STUI_STATS_T *st = &ctx->stats;
+    unsigned long calls = 0;
+    unsigned int i, now;
+    
+    if ( lock_ctx( ctx ) )
+        return;
+    
+    osal_get_systime( NULL, &now );
+    
+    /* The overlay's own callbacks are left out, so that it does not
+       distort the figures it shows */
+    for ( i = 0; i < n_work; i++ )
+    {
+        work[i]->calls += work[i]->paint.calls;
+        work[i]->us    += work[i]->paint.us;
+        if ( work[i] == ctx->hud )
+            continue;
+        calls          += work[i]->paint.calls;
+        st->paint_us   += work[i]->paint.us;
+    }
+    st->callbacks += calls;
+    if ( calls > st->callbacks_max )
+        st->callbacks_max = calls;
+    
+    if ( cells < 0 )
+        st->frames_skipped++;
+    else
+    {
+        ctx->frame_times[ st->frames % STUI_HUD_FRAMES ] = now - start;
+        st->frames++;
+        st->cells += cells;
+        st->frame_us += now - start;
+        if ( now - start > st->frame_max_us )
+            st->frame_max_us = now - start;
+        
+        if ( since )
+        {
+            st->latency_us += now - *since;
+            if ( now - *since > st->latency_max_us )
+                st->latency_max_us = now - *since;
+        }
+        
+        if ( ctx->ops->get_bytes )
+            st->bytes = ctx->ops->get_bytes( ctx->drv );
+    }
+    
+    /* The overlay is brought up to date in a frame of its own, so it is
+       only updated while other frames are being drawn */
+    if ( ctx->hud && now - ctx->hud_time >= STUI_HUD_INTERVAL * 1000 )
+        kick_server( ctx );
+    
+    unlock_ctx( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Compare two frame times, for qsort().
+**/
+static int cmp_times( const void *a, const void *b )
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+/*****************************************************************************/
+/**
+    Average time taken by a window's callback since the performance overlay
+    was last updated, in microseconds.
+**/
+static unsigned long hud_average( const struct window *win )
+{
+    return ( win->us - win->hud_us ) / ( win->calls - win->hud_calls );
+}
+
+/*****************************************************************************/
+/**
+    Write the text of the performance overlay, from the statistics gathered
+    since it was last updated and the times of the most recent frames.
+    
+    @param ctx       Context.
+    @param now       The time now, in microseconds.
+**/
+static void write_hud( struct stui_context *ctx, unsigned int now )
+{
+    const STUI_STATS_T *st = &ctx->stats, *old = &ctx->hud_stats;
+    unsigned int times[STUI_HUD_FRAMES];
+    struct window *slow[STUI_HUD_TOP];
+    struct window *win;
+    unsigned long frames = st->frames - old->frames;
+    unsigned long per = frames ? frames : 1;
+    unsigned long timed = st->locks_timed - old->locks_timed;
+    double hold = 0.0;
+    unsigned int elapsed = now - ctx->hud_time;
+    unsigned int i, j, n;
+    
+    memset( ctx->hud_text, 0, sizeof(ctx->hud_text) );
+    
+    /* What is being sent to the terminal */
+    snprintf( ctx->hud_text[0], HUD_COLS, "fps %.1f  bytes/f %lu",
+              elapsed ? frames * 1e6 / elapsed : 0.0, 
+              ( st->bytes - old->bytes ) / per );
+    
+    /* How long the compositor takes over it */
+    n = st->frames < STUI_HUD_FRAMES ? (unsigned int)st->frames 
+                                     : STUI_HUD_FRAMES;
+    if ( n )
+    {
+        memcpy( times, ctx->frame_times, n * sizeof(times[0]) );
+        qsort( times, n, sizeof(times[0]), cmp_times );
+        snprintf( ctx->hud_text[1], HUD_COLS, 
+                  "frame us p50 %u p90 %u p99 %u",
+                  times[ ( n - 1 ) * 50 / 100 ], times[ ( n - 1 ) * 90 / 100 ],
+                  times[ ( n - 1 ) * 99 / 100 ] );
+    }
+    /* Only some holds of the lock may have been timed, so scale up the time
+       they were held for to cover all of them */
+    if ( timed )
+        hold = (double)( st->lock_hold_us - old->lock_hold_us )
+               * ( st->locks - old->locks ) / timed;
+    snprintf( ctx->hud_text[2], HUD_COLS, "us/f callbacks %lu lock %lu",
+              ( st->paint_us - old->paint_us ) / per,
+              (unsigned long)( hold / per ) );
+    
+    /* The windows whose callbacks are slowest, slowest first */
+    n = 0;
+    for ( win = ctx->root; win; win = win->up )
+    {
+        if ( win == ctx->hud || win->calls == win->hud_calls )
+            continue;
+        
+        for ( i = n; i > 0 && hud_average( slow[i - 1] ) < hud_average( win ); i-- )
+            if ( i < STUI_HUD_TOP )
+                slow[i] = slow[i - 1];
+        
+        if ( i < STUI_HUD_TOP )
+        {
+            slow[i] = win;
+            if ( n < STUI_HUD_TOP )
+                n++;
+        }
+    }
+    
+    for ( j = 0; j < n; j++ )
+        snprintf( ctx->hud_text[3 + j], HUD_COLS, "win %u  %lu us x %lu", 
+                  slow[j]->id, hud_average( slow[j] ), 
+                  slow[j]->calls - slow[j]->hud_calls );
+    
+    for ( win = ctx->root; win; win = win->up )
+    {
+        win->hud_calls = win->calls;
+        win->hud_us    = win->us;
+    }
+    
+    ctx->hud_stats = *st;
+    ctx->hud_time  = now;
+}
+
+/*****************************************************************************/
+/**
+    Callback for the performance overlay, which shows the text last written
+    by write_hud().
+**/
+static void paint_hud( STUI_WINDOW_T hWnd, 
+                       unsigned int tlr, unsigned int tlc, 
+                       unsigned int brr, unsigned int brc )
+{
+    struct window *win = (struct window *)hWnd;
+    unsigned int row;
+    
+    stui_cb_fill_rect( hWnd, tlr, tlc, brc - tlc, brr - tlr, 
+                       STUI_ATTR_REVERSE | ' ' );
+    
+    for ( row = tlr; row < brr && row < HUD_ROWS; row++ )
+        stui_cb_write_text( hWnd, row, 1, STUI_ATTR_REVERSE, 
+                            win->ctx->hud_text[row] );
+}
+
+/*****************************************************************************/
+/**
+    Keep the performance overlay on top of the other windows, in the top
+    right corner of the screen, and update it if it is due.
+**/
+static void update_hud( struct stui_context *ctx )
+{
+    struct window *win = ctx->hud;
+    unsigned int col, now;
+    
+    if ( ctx->top != win )
+        raise_window( win );
+    
+    col = ctx->vis.width > HUD_COLS ? ctx->vis.width - HUD_COLS : 0;
+    if ( win->col != col || !win->width )
+        redim_window( win, 0, col, HUD_COLS, HUD_ROWS );
+    
+    osal_get_systime( NULL, &now );
+    if ( now - ctx->hud_time >= STUI_HUD_INTERVAL * 1000 )
+    {
+        write_hud( ctx, now );
+        damage_window( win );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Draw a frame for a context.
+    
+    The lock is only held while catching up with changes to the windows and
+    taking the work for the frame.  The callbacks and the output to the
+    terminal happen without it, so the application is never held up by them.
+**/
+static void serve_context( struct stui_context *ctx )
+{
+    struct window * hWnd;
+    unsigned int start, since;
+    int need_refresh, dirty;
+    long cells = -1;
+    
+    osal_get_systime( NULL, &start );
+    
+    /* Catch up with the terminal first, and give the application the chance
+       to lay out its windows for the new size before the frame is drawn.
+    */
+    if ( ctx->check_size )
+    {
+        STUI_NOTIFY_T fn = NULL;
+        unsigned int rows = 0, cols = 0;
+        
+        ctx->check_size = 0;
+        if ( !lock_ctx( ctx ) )
+        {
+            if ( resize_visual( ctx ) )
+            {
+                fn   = ctx->notify;
+                rows = ctx->vis.height;
+                cols = ctx->vis.width;
+                trace( "term_resize %u %u %u", ctx->id, rows, cols );
+            }
+            unlock_ctx( ctx );
+        }
+        
+        if ( fn )
+            fn( (STUI_CONTEXT_T)ctx, STUI_MSG_TERM_RESIZE, rows, cols );
+    }
+    
+    if ( lock_ctx( ctx ) )
+        return;
+    
+    /* The server is already awake, so there is no need for it to be kicked
+       by anything it does itself.  While the application is in the middle
+       of updating, leave the context alone until it has finished.
+    */
+    ctx->wake_pending = 1;
+    if ( ctx->update_depth )
+    {
+        ctx->stats.frames_skipped++;
+        unlock_ctx( ctx );
+        return;
+    }
+    ctx->cmd_pending  = 0;
+    
+    /* Catch up with the changes made by the application */
+    drain_commands( ctx );
+    free_zombies( ctx );
+    if ( ctx->hud )
+        update_hud( ctx );
+    for ( hWnd = ctx->root; hWnd; hWnd = hWnd->up )
+        apply_changes( hWnd );
+    ctx->owners_stale = 0;
+    
+    /* Carry out any scrolling requested by the application */
+    need_refresh = ctx->screen_dirty;
+    for ( hWnd = ctx->root; hWnd; hWnd = hWnd->up )
+    {
+        if ( hWnd->scroll && hWnd->paint.visible )
+        {
+            scroll_window( hWnd, hWnd->scroll );
+            need_refresh = 1;
+        }
+        else if ( hWnd->scroll && hWnd->bbuf )
+            scroll_backing( hWnd, hWnd->scroll );
+        hWnd->scroll = 0;
+    }
+    
+    take_work( ctx );
+    
+    since = ctx->dirty_since;
+    dirty = ctx->dirty;
+    ctx->dirty        = 0;
+    ctx->screen_dirty = 0;
+    ctx->wake_pending = 0;
+    unlock_ctx( ctx );
+    
+    if ( do_work() )
+        need_refresh = 1;
+    
+    /* Present the frame in the best way the driver has */
+    if ( need_refresh )
+    {
+        const struct drv_ops *ops = ctx->ops;
+        unsigned int i, n;
+        
+        if ( ops->caps & DRV_CAP_SYNC )
+            ops->begin_frame( ctx->drv );
+        
+        if ( ops->caps & DRV_CAP_SCROLL )
+            detect_scroll( ctx );
+        n = diff_frames( ctx );
+        
+        if ( ops->caps & DRV_CAP_DIFF )
+            ops->put_runs( ctx->drv, ctx->vis.vbuf, ctx->vis.runs, n );
+        else if ( n )
+            ops->put_screen( ctx->drv, ctx->vis.vbuf );
+        
+        if ( ops->caps & DRV_CAP_SYNC )
+            ops->end_frame( ctx->drv );
+        
+        for ( cells = 0, i = 0; i < n; i++ )
+            cells += ctx->vis.runs[i].len;
+    }
+    
+    count_frame( ctx, start, dirty ? &since : NULL, cells );
+}
+
+/*****************************************************************************/
+/**
+    Server task
+    
+    Sleeps until a context needs it, then updates that context's screen.
+    Updates to each screen are spaced at least its frame_interval apart, so
+    that any further changes made in the meantime are coalesced into the
+    same frame.  A single task serves all of the contexts.
+**/
+static void server_task( osal_task_t *tcb, void * param1, void *param2 )
+{
+    struct stui_context *ctx;
+    unsigned int now, elapsed, wait;
+    OSAL_SUSPEND suspend = OSAL_SUSPEND_FOREVER;
+    
+    while(1)
+    {
+        osal_sem_obtain( &svr_wake, suspend );
+        
+        if ( osal_mutex_obtain( &ctx_lock, OSAL_SUSPEND_FOREVER ) )
+            continue;
+        
+        /* The driver cannot tell which terminal was resized, so check them
+           all */
+        if ( resize_pending )
+        {
+            resize_pending = 0;
+            for ( ctx = contexts; ctx; ctx = ctx->next )
+                ctx->check_size = ctx->signalled = 1;
+        }
+        
+        /* Serve each context that is due a frame, and sleep until the next
+           one is due */
+        suspend = OSAL_SUSPEND_FOREVER;
+        for ( ctx = contexts; ctx; ctx = ctx->next )
+        {
+            if ( !ctx->signalled )
+                continue;
+            
+            osal_get_systime( NULL, &now );
+            elapsed = ( now - ctx->last_frame ) / 1000;
+            if ( elapsed < ctx->frame_interval )
+            {
+                wait = ctx->frame_interval - elapsed;
+                if ( OSAL_SUSPEND_FOREVER == suspend || wait < (unsigned int)suspend )
+                    suspend = (OSAL_SUSPEND)wait;
+                continue;
+            }
+            
+            ctx->signalled = 0;
+            serve_context( ctx );
+            osal_get_systime( NULL, &ctx->last_frame );
+        }
+        
+        osal_mutex_release( &ctx_lock );
+    }   
+}
+
+/*****************************************************************************/
+/**
+    Redimension a window (size and position).  The server catches up with the
+    change at the next frame.
+**/
+static void redim_window( struct window *win, 
+                          unsigned int row, unsigned int col, 
+                          unsigned int width, unsigned int height )
+{
+    struct stui_context *ctx = win->ctx;
+    
+    win->row = row;
+    win->col = col;
+    win->width = width;
+    win->height = height;
+    
+    /* Windows sized to fill the screen reach to its far edges */
+    if ( win->flag.auto_width )
+        win->width  = ctx->vis.width  > col ? ctx->vis.width  - col : 0;
+    if ( win->flag.auto_height )
+        win->height = ctx->vis.height > row ? ctx->vis.height - row : 0;
+    
+    if ( win->flag.visible )   
+        kick_server( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Put a window on top of all the others.
+**/
+static void raise_window( struct window *win )
+{
+    struct stui_context *ctx = win->ctx;
+    
+    /* Nothing to do if already on top */
+    if ( !win->up )
+        return;
+    
+    /* remove window from list */
+    if ( win->down )
+        win->down->up = win->up;
+    else
+        ctx->root = win->up;
+    
+    win->up->down = win->down;
+    
+    /* Put onto top of list */
+    win->up   = NULL;
+    win->down = ctx->top;
+    win->down->up = win;
+    ctx->top = win;
+    win->z = ++ctx->z_top;
+    
+    /* Only the parts of the window that were covered need repainting,
+       which the server works out when it catches up */
+    if ( win->flag.visible )
+        kick_server( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Carry out a window operation.  Only the requested state of the window is
+    changed, so any number of operations on a window between frames cost no
+    more than the last of them once the server catches up.
+**/
+static void run_command( const struct command *cmd )
+{
+    struct window *win = cmd->win;
+    struct stui_context *ctx = win->ctx;
+    
+    if ( CMD_REPAINT != cmd->op && CMD_SCROLL != cmd->op )
+        ctx->owners_stale = 1;
+    
+    switch ( cmd->op )
+    {
+    case CMD_DESTROY:
+        /* remove window from list */
+        if ( win->down )
+            win->down->up = win->up;
+        else
+            ctx->root = win->up;
+        
+        if ( win->up )
+            win->up->down = win->down;
+        else
+            ctx->top = win->down;
+        
+        /* The server may still be painting the window, so leave it to the
+           server to free it and expose whatever was underneath */
+        win->flag.visible = 0;
+        win->up  = ctx->zombies;
+        ctx->zombies  = win;
+        kick_server( ctx );
+        break;
+        
+    case CMD_SHOW:
+        if ( !win->flag.visible )
+        {
+            win->flag.visible = 1;
+            kick_server( ctx );
+        }
+        else
+            damage_window( win );
+        break;
+        
+    case CMD_HIDE:
+        if ( win->flag.visible )
+        {
+            win->flag.visible = 0;
+            kick_server( ctx );
+        }
+        break;
+        
+    case CMD_MOVE:
+        redim_window( win, cmd->a, cmd->b, win->width, win->height );
+        break;
+        
+    case CMD_RESIZE:
+        /* If either of the new dimensions are 0 then the window is sized to
+           the visual, and follows it if the terminal is resized.
+        */
+        win->flag.auto_width  = ( 0 == cmd->a );
+        win->flag.auto_height = ( 0 == cmd->b );
+        redim_window( win, win->row, win->col, cmd->a, cmd->b );
+        break;
+        
+    case CMD_RAISE:
+        raise_window( win );
+        break;
+        
+    case CMD_REPAINT:
+        if ( win->bbuf )
+        {
+            struct rect r = { 0, 0, 0, 0 };
+            
+            r.bottom = win->paint.height;
+            r.right  = win->paint.width;
+            invalidate_backing( win, &r );
+        }
+        
+        if ( win->flag.visible )
+            damage_window( win );
+        break;
+        
+    case CMD_SCROLL:
+        if ( win->flag.visible || win->bbuf )
+        {
+            win->scroll += (int)cmd->a;
+            kick_server( ctx );
+        }
+        break;
+    }
+}
+
+/*****************************************************************************/
+/**
+    Carry out all queued window operations, in the order they were made.
+**/
+static void drain_commands( struct stui_context *ctx )
+{
+    struct command cmd;
+    
+    while ( !osal_queue_recv_from( &ctx->cmd_queue, &cmd, OSAL_SUSPEND_NEVER ) )
+        run_command( &cmd );
+}
+
+/*****************************************************************************/
+/**
+    Submit a window operation.  In asynchronous mode it is queued for the
+    server.  Otherwise, or if the queue is full, it is carried out straight
+    away after any operations already queued.
+**/
+static void submit( int op, struct window *win, unsigned int a, unsigned int b )
+{
+    struct stui_context *ctx = win->ctx;
+    struct command cmd;
+    
+    cmd.op  = op;
+    cmd.win = win;
+    cmd.a   = a;
+    cmd.b   = b;
+    
+    if ( CMD_SCROLL == op )
+        trace( "%s %u:%u %d", cmd_names[op], ctx->id, win->id, (int)a );
+    else
+        trace( "%s %u:%u %u %u", cmd_names[op], ctx->id, win->id, a, b );
+    
+    if ( ctx->async_mode 
+        && !osal_queue_send_to( &ctx->cmd_queue, &cmd, OSAL_SUSPEND_NEVER ) )
+    {
+        if ( !ctx->cmd_pending )
+        {
+            ctx->cmd_pending = 1;
+            wake_server( ctx );
+        }
+        return;
+    }
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        drain_commands( ctx );
+        run_command( &cmd );
+        unlock_ctx( ctx );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Allocate a window and put it at the bottom of a context's windows.  The
+    caller must hold the context's lock.
+    
+    @return The window, or NULL if failed.
+**/
+static struct window * alloc_window( struct stui_context *ctx, 
+                                     STUI_CALLBACK_T cb, unsigned int flags )
+{
+    struct window *win = calloc( 1, sizeof(*win) );
+    
+    if ( !win )
+        return NULL;
+    
+    win->ctx = ctx;
+    win->callback = cb;
+    win->flag.retained = !!( flags & STUI_WINDOW_RETAINED );
+    win->z = --ctx->z_bottom;
+    
+    if ( ctx->root )
+    {
+        win->up = ctx->root;
+        win->up->down = win;
+    }
+    else
+        ctx->top = win;
+    
+    ctx->root = win;
+    
+    return win;
+}
+
+/*****************************************************************************/
+/**
+    Release a visual's buffers and window index.
+**/
+static void free_visual( struct visual *v, struct grid *g )
+{
+    unsigned int i;
+    
+    free( v->vbuf );
+    free( v->fbuf );
+    free( v->runs );
+    free( v->bhash );
+    free( v->fhash );
+    free( v->owner );
+    free( v->otmp );
+    
+    if ( g->tiles )
+        for ( i = 0; i < g->rows * g->cols; i++ )
+            free( g->tiles[i].wins );
+    free( g->tiles );
+}
+
+/*****************************************************************************/
+/**
+    Allocate the buffers and window index for a visual of the given size.  The
+    visual is blank, with no windows, and as nothing has been presented yet
+    the front buffer is invalid, forcing the whole screen to be sent.
+    
+    @return 0 if successful, -1 if failure.
+**/
+static int alloc_visual( struct visual *v, struct grid *g, 
+                         unsigned int rows, unsigned int cols )
+{
+    unsigned int i;
+    
+    v->width  = cols;
+    v->height = rows;
+    v->vbuf   = calloc( rows * cols, sizeof(STUI_CHAR_T) );
+    v->fbuf   = calloc( rows * cols, sizeof(STUI_CHAR_T) );
+    
+    /* At most every other cell on a row can start a run */
+    v->runs   = calloc( rows * ( ( cols + 1 ) / 2 ), sizeof(struct drv_run) );
+    v->bhash  = calloc( rows, sizeof(unsigned long) );
+    v->fhash  = calloc( rows, sizeof(unsigned long) );
+    v->owner  = calloc( rows * cols, sizeof(struct window *) );
+    v->otmp   = calloc( rows * cols, sizeof(struct window *) );
+    
+    g->rows   = ( rows + TILE_ROWS - 1 ) / TILE_ROWS;
+    g->cols   = ( cols + TILE_COLS - 1 ) / TILE_COLS;
+    g->tiles  = calloc( g->rows * g->cols, sizeof(struct tile) );
+    
+    if ( !v->vbuf || !v->fbuf || !v->runs || !v->bhash || !v->fhash
+        || !v->owner || !v->otmp || !g->tiles )
+    {
+        free_visual( v, g );
+        return -1;
+    }
+    
+    for ( i = 0; i < rows * cols; i++ )
+    {
+        v->vbuf[i] = ' '; /* | STUI_ATTR_REVERSE; */
+        v->fbuf[i] = INVALID_CELL;
+    }
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+    Bring the visual up to date with the size of the screen.
+    
+    The buffers and window index are reallocated for the new size, keeping
+    the part of the screen that is still there along with its owners, so only
+    the cells that have come into view are repainted.  Windows sized to fill
+    the screen are resized to match, and all other windows keep their size and
+    position, clipped to the screen.  As the terminal may have reflowed or
+    cleared its contents the whole screen is presented again.  If there is
+    not enough memory the old size is kept.
+    
+    @return non-zero if the size of the visual changed.
+**/
+static int resize_visual( struct stui_context *ctx )
+{
+    struct visual nv = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0 };
+    struct grid ng = { NULL, 0, 0 };
+    struct rect sr = { 0, 0, 0, 0 };
+    struct window *win;
+    unsigned int rows, cols, row, w, h, i;
+    
+    ctx->ops->get_screen_size( ctx->drv, &rows, &cols );
+    if ( ( rows == ctx->vis.height && cols == ctx->vis.width )
+        || alloc_visual( &nv, &ng, rows, cols ) )
+        return 0;
+    
+    /* Destroyed windows are only listed in the old index, so let go of
+       them now */
+    free_zombies( ctx );
+    
+    h = MIN( rows, ctx->vis.height );
+    w = MIN( cols, ctx->vis.width  );
+    for ( row = 0; row < h; row++ )
+    {
+        memcpy( nv.vbuf  + ( row * cols ), ctx->vis.vbuf  + ( row * ctx->vis.width ),
+                w * sizeof(STUI_CHAR_T) );
+        memcpy( nv.owner + ( row * cols ), ctx->vis.owner + ( row * ctx->vis.width ),
+                w * sizeof(struct window *) );
+    }
+    
+    free_visual( &ctx->vis, &ctx->grid );
+    ctx->vis  = nv;
+    ctx->grid = ng;
+    
+    sr.bottom = rows;
+    sr.right  = cols;
+    
+    /* Index the windows afresh and drop any damage that is now off screen */
+    for ( win = ctx->root; win; win = win->up )
+    {
+        win->indexed.top = win->indexed.bottom = 0;
+        if ( win->paint.visible )
+            grid_insert( win );
+        
+        for ( i = 0; i < win->n_damage; i++ )
+            rect_intersect( &win->damage[i], &win->damage[i], &sr );
+        
+        if ( win->flag.auto_width || win->flag.auto_height )
+            redim_window( win, win->row, win->col, win->width, win->height );
+    }
+    
+    /* Cells that have come into view are damaged in their owners */
+    update_owners( ctx, &sr );
+    ctx->owners_stale = 1;
+    ctx->screen_dirty = 1;
+    kick_server( ctx );
+    
+    return 1;
+}
+
+/*****************************************************************************/
+/**
+    Resize hook registered with the driver, which may call it from a signal
+    handler.  The server picks up the new size when it wakes.
+**/
+static void term_resized( void )
+{
+    resize_pending = 1;
+    osal_sem_release_INT( &svr_wake );
+}
+
+/*****************************************************************************/
+/**
+    Set up the server task and everything else shared by the contexts.
+    
+    @return 0 if successful, -1 if failure.
+**/
+static int svr_start( void )
+{
+    if ( osal_mutex_init( &ctx_lock, "stui:ctxlock" ) )
+        return -1;
+    
+    if ( osal_sem_init( &svr_wake, 0, "stui:svrwake" ) )
+    {
+        osal_mutex_destroy( &ctx_lock );
+        return -1;
+    }
+    
+#if STUI_WORKER_TASKS > 0
+    if ( start_workers() )
+    {
+        osal_sem_destroy( &svr_wake );
+        osal_mutex_destroy( &ctx_lock );
+        return -1;
+    }
+#endif
+    
+    if ( osal_task_init( &serverTCB, 0, server_task, NULL, NULL, 10, "stui_server" ) )
+    {
+#if STUI_WORKER_TASKS > 0
+        stop_workers( STUI_WORKER_TASKS );
+#endif
+        osal_sem_destroy( &svr_wake );
+        osal_mutex_destroy( &ctx_lock );
+        return -1;
+    }
+    
+    if ( osal_task_start( &serverTCB ) )
+    {
+        osal_task_destroy( &serverTCB );
+#if STUI_WORKER_TASKS > 0
+        stop_workers( STUI_WORKER_TASKS );
+#endif
+        osal_sem_destroy( &svr_wake );
+        osal_mutex_destroy( &ctx_lock );
+        return -1;
+    }
+    
+    svr_running = 1;
+    
+    if ( getenv( "STUI_TRACE" ) )
+        stui_trace_start( getenv( "STUI_TRACE" ) );
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+    Release a context and all of its windows.  The context must not be on the
+    list of contexts.
+**/
+static void free_context( struct stui_context *ctx )
+{
+    struct window *win;
+    
+    while ( ctx->root )
+    {
+        win       = ctx->root;
+        ctx->root = win->up;
+        free( win->bbuf );
+        free( win );
+    }
+    
+    while ( ctx->zombies )
+    {
+        win          = ctx->zombies;
+        ctx->zombies = win->up;
+        free( win->bbuf );
+        free( win );
+    }
+    
+    free_visual( &ctx->vis, &ctx->grid );
+    osal_queue_destroy( &ctx->cmd_queue );
+    osal_mutex_destroy( &ctx->svr_lock );
+    ctx->ops->close( ctx->drv );
+    free( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Get the context for a handle, where NULL means the default context.
+**/
+static struct stui_context * get_context( STUI_CONTEXT_T hCtx )
+{
+    return hCtx ? (struct stui_context *)hCtx : default_ctx;
+}
+
+/*****************************************************************************/
+/* Public functions.  Defined in header file.                                */
+/*****************************************************************************/
+
+/*****************************************************************************/
+/**
+    Start tracing calls to the API.
+    
+    Each call that changes the windows or contexts is written to a file as a
+    line of text, giving the time in microseconds since tracing started, the
+    name of the function without the stui_ or stui_context_ prefix, and its
+    arguments.  Contexts are given by number, and windows as context:window
+    numbers.  Terminal resizes are traced as term_resize, so that a trace can
+    be replayed without a terminal to give the same sequence of frames.  For
+    example:
+    
+        0 context_open 1 24 80
+        35 create_window 1:1 0
+        52 resize_window 1:1 20 5
+        60 show_window 1:1 0 0
+    
+    Queries, user data and the output of callbacks are not traced.  Tracing
+    is also started by stui_server() or stui_context_open() if the STUI_TRACE
+    environment variable names a file.  It should be started before any
+    contexts are opened, so that the trace is complete.
+    
+    @param file    Name of file to write the trace to.
+    
+    @return 0 if successful, -1 if failure.
+**/
+extern int stui_trace_start( const char *file )
+{
+    FILE *fp;
+    
+    if ( !trace_lock_ready )
+    {
+        if ( osal_mutex_init( &trace_lock, "stui:trace" ) )
+            return -1;
+        trace_lock_ready = 1;
+    }
+    
+    fp = fopen( file, "w" );
+    if ( !fp )
+        return -1;
+    
+    stui_trace_stop();
+    
+    if ( osal_mutex_obtain( &trace_lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        fclose( fp );
+        return -1;
+    }
+    
+    fprintf( fp, "# stui trace 1\n" );
+    osal_get_systime( NULL, &trace_start_time );
+    trace_fp = fp;
+    osal_mutex_release( &trace_lock );
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+    Stop tracing calls to the API, closing the trace file.
+**/
+extern void stui_trace_stop( void )
+{
+    FILE *fp;
+    
+    if ( !trace_lock_ready 
+        || osal_mutex_obtain( &trace_lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    fp       = trace_fp;
+    trace_fp = NULL;
+    osal_mutex_release( &trace_lock );
+    
+    if ( fp )
+        fclose( fp );
+}
+
+/*****************************************************************************/
+/**
+    Start the STUI server system on the process's controlling terminal.  This
+    becomes the default context, used by the functions that do not take a
+    context.
+    
+    @return 0 if successful, -1 if failure.
+**/
+extern int stui_server( void )
+{
+    default_ctx = (struct stui_context *)stui_context_open( NULL );
+    
+    return default_ctx ? 0 : -1;
+}
+
+/*****************************************************************************/
+/**
+    Open a context on a terminal.
+    
+    Each context has its own windows and screen, and its own lock, while the
+    server task and worker tasks are shared by all of the contexts in the
+    process.  A context handle of NULL given to any of the stui_context_xxx()
+    functions refers to the default context, opened by stui_server().
+    
+    This function must not be called from a callback or notification
+    function.
+    
+    @param device  Path of the terminal device, or NULL for the controlling
+                   terminal.
+    
+    @return Context handle if successful, NULL if failed.
+**/
+extern STUI_CONTEXT_T stui_context_open( const char *device )
+{
+    return stui_context_open_driver( NULL, device );
+}
+
+/*****************************************************************************/
+/**
+    Open a context on a device handled by a particular driver.
+    
+    If no driver is given the one named by the STUI_DRIVER environment
+    variable is used, or failing that the default (xterm) driver.  Likewise
+    if no device is given either, the STUI_DEVICE environment variable names
+    the device.  If the STUI_HUD environment variable is set to anything
+    but 0 the context starts with the performance overlay shown.
+    
+    This function must not be called from a callback or notification
+    function.
+    
+    @param driver  Name of a registered driver, or NULL.
+    @param device  Device to open, which is up to the driver.  NULL asks for
+                   the driver's default device.
+    
+    @return Context handle if successful, NULL if failed.
+**/
+extern STUI_CONTEXT_T stui_context_open_driver( const char *driver, 
+                                                const char *device )
+{
+    struct stui_context *ctx;
+    unsigned int rows, cols;
+    
+    if ( !svr_running && svr_start() )
+        return NULL;
+    
+    if ( !driver )
+    {
+        driver = getenv( "STUI_DRIVER" );
+        if ( !device )
+            device = getenv( "STUI_DEVICE" );
+    }
+    
+    ctx = calloc( 1, sizeof(*ctx) );
+    if ( !ctx )
+        return NULL;
+    
+    ctx->frame_interval = STUI_FRAME_INTERVAL;
+    
+    ctx->ops = drv_find( driver );
+    ctx->drv = ctx->ops ? ctx->ops->open( device ) : NULL;
+    if ( !ctx->drv )
+    {
+        free( ctx );
+        return NULL;
+    }
+    
+    if ( osal_mutex_init( &ctx->svr_lock, "stui:svrlock" ) )
+    {
+        ctx->ops->close( ctx->drv );
+        free( ctx );
+        return NULL;
+    }
+    
+    if ( osal_queue_init( &ctx->cmd_queue, STUI_CMD_QUEUE_LEN, 
+                          sizeof(struct command), "stui:cmdq" ) )
+    {
+        osal_mutex_destroy( &ctx->svr_lock );
+        ctx->ops->close( ctx->drv );
+        free( ctx );
+        return NULL;
+    }
+    
+    ctx->ops->get_screen_size( ctx->drv, &rows, &cols );
+    if ( alloc_visual( &ctx->vis, &ctx->grid, rows, cols ) )
+    {
+        osal_queue_destroy( &ctx->cmd_queue );
+        osal_mutex_destroy( &ctx->svr_lock );
+        ctx->ops->close( ctx->drv );
+        free( ctx );
+        return NULL;
+    }
+    
+    osal_get_systime( NULL, &ctx->last_frame );
+    
+    /* Listen out for the terminal being resized */
+    if ( ctx->ops->set_resize_hook )
+        ctx->ops->set_resize_hook( term_resized );
+    
+    if ( osal_mutex_obtain( &ctx_lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        free_context( ctx );
+        return NULL;
+    }
+    
+    ctx->id   = ++last_ctx_id;
+    ctx->next = contexts;
+    contexts  = ctx;
+    osal_mutex_release( &ctx_lock );
+    
+    trace( "context_open %u %u %u", ctx->id, rows, cols );
+    
+    if ( getenv( "STUI_HUD" ) && strcmp( getenv( "STUI_HUD" ), "0" ) )
+        stui_context_set_hud( (STUI_CONTEXT_T)ctx, 1 );
+    
+    return (STUI_CONTEXT_T)ctx;
+}
+
+/*****************************************************************************/
+/**
+    Close a context, destroying all of its windows and releasing its
+    terminal.
+    
+    This function must not be called from a callback or notification
+    function.
+    
+    @param hCtx    Handle of context to close.
+**/
+extern void stui_context_close( STUI_CONTEXT_T hCtx )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    struct stui_context **pp;
+    
+    if ( !ctx || osal_mutex_obtain( &ctx_lock, OSAL_SUSPEND_FOREVER ) )
+        return;
+    
+    for ( pp = &contexts; *pp; pp = &(*pp)->next )
+    {
+        if ( *pp == ctx )
+        {
+            *pp = ctx->next;
+            break;
+        }
+    }
+    
+    if ( ctx == default_ctx )
+        default_ctx = NULL;
+    
+    osal_mutex_release( &ctx_lock );
+    
+    trace( "context_close %u", ctx->id );
+    
+    free_context( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Get the default context.
+    
+    @return Context handle, or NULL if stui_server() has not been called.
+**/
+extern STUI_CONTEXT_T stui_context_default( void )
+{
+    return (STUI_CONTEXT_T)default_ctx;
+}
+
+/*****************************************************************************/
+/**
+    Get the driver handle of a context, for use with functions particular to
+    the driver, such as those of the memory driver.
+    
+    @param hCtx    Context handle.
+    
+    @return Driver handle.
+**/
+extern void * stui_context_get_driver( STUI_CONTEXT_T hCtx )
+{
+    return get_context( hCtx )->drv;
+}
+
+/*****************************************************************************/
+/**
+    Get the context a window belongs to.
+    
+    @param hWnd    Handle to window to query.
+    
+    @return Context handle.
+**/
+extern STUI_CONTEXT_T stui_window_context( STUI_WINDOW_T hWnd )
+{
+    return (STUI_CONTEXT_T)( (struct window *)hWnd )->ctx;
+}
+
+/*****************************************************************************/
+/**
+    Set the minimum interval between screen updates of a context.
+    
+    Changes made to windows within one interval are presented together in a
+    single frame.  When nothing changes the server sleeps indefinitely.
+    
+    @param hCtx      Context handle.
+    @param ms        Minimum frame interval in milliseconds.  0 presents
+                     every change as soon as possible.
+**/
+extern void stui_context_set_frame_interval( STUI_CONTEXT_T hCtx, unsigned int ms )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        ctx->frame_interval = ms;
+        unlock_ctx( ctx );
+        trace( "set_frame_interval %u %u", ctx->id, ms );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Set the minimum interval between screen updates of the default context.
+    
+    @param ms        Minimum frame interval in milliseconds.
+**/
+extern void stui_set_frame_interval( unsigned int ms )
+{
+    stui_context_set_frame_interval( NULL, ms );
+}
+
+/*****************************************************************************/
+/**
+    Select whether window operations in a context are carried out
+    asynchronously.
+    
+    In asynchronous mode stui_destroy_window(), stui_show_window(), 
+    stui_hide_window(), stui_move_window(), stui_resize_window(), 
+    stui_raise_window(), stui_repaint() and stui_scroll_window() queue the
+    operation for the server and return without waiting for the lock.  The
+    operations are carried out in order at the start of the next frame, so
+    the effect is not seen by other calls such as stui_get_window_dims() 
+    until then.
+    
+    @param hCtx      Context handle.
+    @param enable    Non-zero to queue window operations, 0 to carry them out
+                     straight away.
+**/
+extern void stui_context_set_async( STUI_CONTEXT_T hCtx, int enable )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        drain_commands( ctx );
+        ctx->async_mode = !!enable;
+        unlock_ctx( ctx );
+        trace( "set_async %u %d", ctx->id, !!enable );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Select whether window operations in the default context are carried out
+    asynchronously.
+    
+    @param enable    Non-zero to queue window operations.
+**/
+extern void stui_set_async( int enable )
+{
+    stui_context_set_async( NULL, enable );
+}
+
+/*****************************************************************************/
+/**
+    Set the function told about changes to a context's terminal.
+    
+    The function is called from the server task, without holding any locks,
+    so it may call any of the window functions.  Messages are:
+    
+      STUI_MSG_TERM_RESIZE  The terminal has been resized.  The parameters
+                            are the new number of rows and columns.  Windows
+                            sized with stui_resize_window( hWnd, 0, 0 ) have
+                            already been resized to match.
+    
+    @param hCtx      Context handle.
+    @param fn        Function to call, or NULL for none.
+**/
+extern void stui_context_set_notify( STUI_CONTEXT_T hCtx, STUI_NOTIFY_T fn )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        ctx->notify = fn;
+        unlock_ctx( ctx );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Set the function told about changes to the default context's terminal.
+    
+    @param fn        Function to call, or NULL for none.
+**/
+extern void stui_set_notify( STUI_NOTIFY_T fn )
+{
+    stui_context_set_notify( NULL, fn );
+}
+
+/*****************************************************************************/
+/**
+    Get the size of a context's screen.
     
-    Updates the screen at regular intervals.
+    @param hCtx      Context handle.
+    @param p_rows    Pointer to store the number of rows.  Can be NULL.
+    @param p_cols    Pointer to store the number of columns.  Can be NULL.
 **/
-static void server_task( osal_task_t *tcb, void * param1, void *param2 )
+extern void stui_context_get_screen_size( STUI_CONTEXT_T hCtx,
+                                          unsigned int *p_rows, 
+                                          unsigned int *p_cols )
 {
-    while(1)
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
     {
-        osal_task_sleep( 100 );
-
-        if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-   {
-            struct window * hWnd;
-       int need_refresh;
-       
-       need_refresh = 0;
-       for ( hWnd = root; hWnd; hWnd = hWnd->up )
-       {
-          if ( hWnd->flag.visible && hWnd->flag.dirty ) 
-      {
-          /* Do the simple full repaint for the moment */
-          hWnd->callback( hWnd, 0, 0, hWnd->height, hWnd->width );
-          
-          hWnd->flag.dirty = 0;
-          need_refresh     = 1;
-      }
-       }
-       
-       if ( need_refresh )
-           drv_put_screen( vis.vbuf );
-      
-       osal_mutex_release( &svr_lock );
-   }
-    }   
+        if ( p_rows ) *p_rows = ctx->vis.height;
+        if ( p_cols ) *p_cols = ctx->vis.width;
+        unlock_ctx( ctx );
+    }
 }
 
 /*****************************************************************************/
 /**
-    Given source window src mark as dirty all windows that src overlaps.
+    Get the size of the default context's screen.
+    
+    @param p_rows    Pointer to store the number of rows.  Can be NULL.
+    @param p_cols    Pointer to store the number of columns.  Can be NULL.
 **/
-static void mark_dirty_underlapping( struct window * win, struct window * src )
+extern void stui_get_screen_size( unsigned int *p_rows, unsigned int *p_cols )
 {
-    while ( win )
-    {
-        if ( win->flag.visible && !win->flag.dirty )
-   {
-       if (    ( src->col               <= win->col + win->width  ) 
-            && ( src->col + src->width  >= win->col               )
-       && ( src->row               <= win->row + win->height ) 
-       && ( src->row + src->height >= win->row               ) )
-            {
-           win->flag.dirty = 1;       
-       }   
-   }
-   win = win->down;
-    }
+    stui_context_get_screen_size( NULL, p_rows, p_cols );
 }
 
 /*****************************************************************************/
 /**
-    Given source window src mark as dirty all windows that overlaps src.
+    Start a batch of window operations in a context.
+    
+    Until the matching stui_context_end_update() the server does not draw any
+    frames for the context, so a change of layout involving many windows is
+    presented all at once rather than a piece at a time.  The damage caused
+    by the whole batch is worked out once, when the server catches up.  Calls
+    may be nested, in which case only the outermost stui_context_end_update()
+    has any effect.
+    
+    @param hCtx      Context handle.
 **/
-static void mark_dirty_overlapping( struct window * win, struct window * src )
+extern void stui_context_begin_update( STUI_CONTEXT_T hCtx )
 {
-    while ( win )
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
     {
-       if ( win->flag.visible && !win->flag.dirty )
-       {
-           if (    ( win->col               <= src->col + src->width  )
-           && ( win->col + win->width  >= src->col               )
-      && ( win->row               <= src->row + src->height )
-      && ( win->row + win->height >= src->row               ) )
-      {
-         win->flag.dirty = 1;
-         mark_dirty_overlapping( win->up, win );      
-      }       
-       }
-       win = win->up;
+        ctx->update_depth++;
+        unlock_ctx( ctx );
+        trace( "begin_update %u", ctx->id );
     }
 }
 
 /*****************************************************************************/
 /**
-    Redimension a window (size and position) doing any dirty tagging if the 
-    window is visible.
+    Finish a batch of window operations started by
+    stui_context_begin_update(), letting the server present the result.
+    
+    @param hCtx      Context handle.
 **/
-static void redim_window( struct window *win, 
-                          unsigned int row, unsigned int col, 
-           unsigned int width, unsigned int height )
+extern void stui_context_end_update( STUI_CONTEXT_T hCtx )
 {
-    if ( win->flag.visible )
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
     {
-   mark_dirty_underlapping( win->down, win );
-   mark_dirty_overlapping( root->up, root );
+        if ( ctx->update_depth && !--ctx->update_depth )
+        {
+            ctx->wake_pending = 0;
+            kick_server( ctx );
+        }
+        unlock_ctx( ctx );
+        trace( "end_update %u", ctx->id );
     }
-
-    win->row = row;
-    win->col = col;
-    win->width = width;
-    win->height = height;
-    
-    if ( win->flag.visible )   
-   mark_dirty_overlapping( win->up, win );
 }
 
 /*****************************************************************************/
-/* Public functions.  Defined in header file.                                */
-/*****************************************************************************/
+/**
+    Start a batch of window operations in the default context.
+**/
+extern void stui_begin_update( void )
+{
+    stui_context_begin_update( NULL );
+}
 
 /*****************************************************************************/
 /**
-    Start the STUI server system.
-    
-    @return 0 if successful, -1 if failure.
+    Finish a batch of window operations in the default context.
 **/
-extern int stui_server( void )
+extern void stui_end_update( void )
 {
-    unsigned int rows, cols;
-    int status;
-    unsigned int i;
+    stui_context_end_update( NULL );
+}
+
+/*****************************************************************************/
+/**
+    Create a window in the default context.
     
-    status = drv_open();
-    if ( status == -1 )
-        return -1;   
-   
-    status = osal_mutex_init( &svr_lock, "stui:svrlock" );
-    if ( status )
-    {
-        drv_close();
-   return -1;
-    }
-        
-    drv_get_screen_size( &rows, &cols );
-    vis.width  = cols;
-    vis.height = rows;
-    vis.vbuf   = calloc( rows * cols, sizeof(STUI_CHAR_T) );
-    if ( !vis.vbuf )
-    {
-        osal_mutex_destroy( &svr_lock );
-        drv_close();
-        return -1;
-    }
+    The initial window is placed at (0,0), has zero size and is not visible.
     
-    /* Initialise the visual buffer */
-    for ( i = 0; i < vis.width * vis.height; i++ )
-        vis.vbuf[i] = ' '; /* | STUI_ATTR_REVERSE; */
-   
-    if ( osal_task_init( &serverTCB, 0, server_task, NULL, NULL, 10, "stui_server" ) )
-    {
-       free( vis.vbuf );
-   osal_mutex_destroy( &svr_lock );
-   drv_close();
-   return -1;
-    }
+    @param cb      Pointer to callback function.
     
-    if ( osal_task_start( &serverTCB ) )
-    {
-       osal_task_destroy( &serverTCB );
-       free( vis.vbuf );
-   osal_mutex_destroy( &svr_lock );
-   drv_close();
-   return -1;
-    }
+    @return Window handle if successful, NULL if failed.
+**/
+extern STUI_WINDOW_T stui_create_window( STUI_CALLBACK_T cb )
+{
+    return stui_context_create_window( NULL, cb, 0 );
+}
+
+/*****************************************************************************/
+/**
+    Create a window with extra properties in the default context.
     
-    return 0;
+    @param cb      Pointer to callback function.
+    @param flags   Window properties, a combination of STUI_WINDOW_xxx.
+    
+    @return Window handle if successful, NULL if failed.
+**/
+extern STUI_WINDOW_T stui_create_window_ex( STUI_CALLBACK_T cb, 
+                                            unsigned int flags )
+{
+    return stui_context_create_window( NULL, cb, flags );
 }
 
 /*****************************************************************************/
 /**
-    Create a window.
+    Create a window in a context.
     
     The initial window is placed at (0,0), has zero size and is not visible.
+    Its properties are given by flags:
     
+      STUI_WINDOW_RETAINED  The server keeps a copy of the window's contents,
+                            so moving, raising or uncovering the window does
+                            not involve the callback.  The callback is only
+                            called when the window is first shown, resized,
+                            scrolled or explicitly repainted.
+    
+    @param hCtx    Context handle.
     @param cb      Pointer to callback function.
+    @param flags   Window properties, a combination of STUI_WINDOW_xxx.
     
     @return Window handle if successful, NULL if failed.
 **/
-extern STUI_WINDOW_T stui_create_window( STUI_CALLBACK_T cb )
+extern STUI_WINDOW_T stui_context_create_window( STUI_CONTEXT_T hCtx,
+                                                 STUI_CALLBACK_T cb, 
+                                                 unsigned int flags )
 {
+    struct stui_context *ctx = get_context( hCtx );
     struct window * hWnd = NULL;
     
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
+    if ( !lock_ctx( ctx ) )
     {
-       hWnd = calloc( 1, sizeof(*hWnd) );
-   
-       if ( hWnd )
-        {    
-           hWnd->callback = cb;
-    
-           if ( root )
-       {
-           hWnd->up = root;
-      hWnd->up->down = hWnd;
-            }
-      
-            root = hWnd;
-   }
-    
-        osal_mutex_release( &svr_lock );
+        hWnd = alloc_window( ctx, cb, flags );
+        if ( hWnd )
+            hWnd->id = ++ctx->last_win_id;
+        
+        unlock_ctx( ctx );
+        
+        if ( hWnd )
+            trace( "create_window %u:%u %u", ctx->id, hWnd->id, flags );
     }
     
     return (STUI_WINDOW_T)hWnd;
@@ -353,30 +3234,7 @@ extern STUI_WINDOW_T stui_create_window( STUI_CALLBACK_T cb )
 **/
 extern void stui_destroy_window( STUI_WINDOW_T hWnd )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        /* remove window from list */
-   
-        if ( win->down )
-       win->down->up = win->up;
-   else
-       root = win->up;
-   
-   if ( win->up )
-       win->up->down = win->down;
-
-        if ( win->flag.visible )
-   {
-       mark_dirty_underlapping( win->down, win );
-       mark_dirty_overlapping( root->up, root );
-   }
-   
-   free( win );   
-   
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_DESTROY, (struct window *)hWnd, 0, 0 );
 }
 
 /*****************************************************************************/
@@ -387,16 +3245,7 @@ extern void stui_destroy_window( STUI_WINDOW_T hWnd )
 **/
 extern void stui_show_window( STUI_WINDOW_T hWnd )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        win->flag.visible = 1;
-   
-   mark_dirty_overlapping( win, win );
-   
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_SHOW, (struct window *)hWnd, 0, 0 );
 }
 
 /*****************************************************************************/
@@ -407,19 +3256,7 @@ extern void stui_show_window( STUI_WINDOW_T hWnd )
 **/
 extern void stui_hide_window( STUI_WINDOW_T hWnd )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        if ( win->flag.visible )
-   {
-       win->flag.visible = 0;
-       mark_dirty_underlapping( win->down, win );
-       mark_dirty_overlapping( root->up, root );
-   }
-   
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_HIDE, (struct window *)hWnd, 0, 0 );
 }
 
 /*****************************************************************************/
@@ -433,13 +3270,7 @@ extern void stui_hide_window( STUI_WINDOW_T hWnd )
 extern void stui_move_window( STUI_WINDOW_T hWnd, 
                               unsigned int row, unsigned int col )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        redim_window( win, row, col, win->width, win->height );
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_MOVE, (struct window *)hWnd, row, col );
 }
 
 /*****************************************************************************/
@@ -447,32 +3278,15 @@ extern void stui_move_window( STUI_WINDOW_T hWnd,
     Change a window's size.
     
     @param hWnd      Handle to window to move.
-    @param width     New width.  Set to 0 for maximum width.
-    @param height    New height.  Set to 0 for maximum height.
+    @param width     New width.  Set to 0 for maximum width, which follows
+                     the width of the terminal.
+    @param height    New height.  Set to 0 for maximum height, which follows
+                     the height of the terminal.
 **/
 extern void stui_resize_window( STUI_WINDOW_T hWnd, 
                                 unsigned int width, unsigned int height )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        /* If either of the new dimensions are 0 then we need to query the
-    *  driver for the visual dimensions and set accordingly.
-    */
-   if ( 0 == width || 0 == height )
-   {
-       unsigned int rows, cols;
-      
-       drv_get_screen_size( &rows, &cols );
-      
-            if ( 0 == width  ) width  = cols - win->col;
-            if ( 0 == height ) height = rows - win->row;
-        }
-   
-   redim_window( win, win->row, win->col, width, height );
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_RESIZE, (struct window *)hWnd, width, height );
 }
 
 /*****************************************************************************/
@@ -483,36 +3297,7 @@ extern void stui_resize_window( STUI_WINDOW_T hWnd,
 **/
 extern void stui_raise_window( STUI_WINDOW_T hWnd )
 {
-    struct window * win = (struct window *)hWnd;
-    
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
-    {
-        /* First hide the window */
-        if ( win->flag.visible )
-   {
-       mark_dirty_underlapping( win->down, win );
-       mark_dirty_overlapping( root->up, root );
-   }
-   
-        /* remove window from list */
-   if ( win->down )
-       win->down->up = win->up;
-   else
-       root = win->up;
-   
-   if ( win->up )
-       win->up->down = win->down;
-
-        /* Put onto top of list */
-   win->up   = NULL;
-   win->down = root;
-   while ( win->down->up )
-       win->down = win->down->up;
-       
-   win->down->up = win;
-   
-        osal_mutex_release( &svr_lock );
-    }
+    submit( CMD_RAISE, (struct window *)hWnd, 0, 0 );
 }
 
 /*****************************************************************************/
@@ -523,14 +3308,181 @@ extern void stui_raise_window( STUI_WINDOW_T hWnd )
 **/
 extern void stui_repaint( STUI_WINDOW_T hWnd )
 {
-    struct window * win = (struct window *)hWnd;
+    submit( CMD_REPAINT, (struct window *)hWnd, 0, 0 );
+}
+
+/*****************************************************************************/
+/**
+    Scroll the contents of a window.
+    
+    The server moves the existing contents of the window and only asks the
+    window to repaint the rows scrolled into view.  Where possible the
+    terminal itself is told to scroll.
+    
+    @param hWnd      Handle to window to scroll.
+    @param lines     Number of rows to scroll by.  Positive values move the
+                     contents up, exposing new rows at the bottom.  Negative
+                     values move the contents down.
+**/
+extern void stui_scroll_window( STUI_WINDOW_T hWnd, int lines )
+{
+    if ( lines )
+        submit( CMD_SCROLL, (struct window *)hWnd, (unsigned int)lines, 0 );
+}
+
+/*****************************************************************************/
+/**
+    Find the window visible at a position on the screen, for example to route
+    mouse events.
+    
+    @param row       Screen row.
+    @param col       Screen column.
+    
+    @return Handle of the topmost visible window covering the position, or
+            NULL if there is none.
+**/
+extern STUI_WINDOW_T stui_window_at( unsigned int row, unsigned int col )
+{
+    return stui_context_window_at( NULL, row, col );
+}
+
+/*****************************************************************************/
+/**
+    Find the window visible at a position on a context's screen.
+    
+    @param hCtx      Context handle.
+    @param row       Screen row.
+    @param col       Screen column.
+    
+    @return Handle of the topmost visible window covering the position, or
+            NULL if there is none.
+**/
+extern STUI_WINDOW_T stui_context_window_at( STUI_CONTEXT_T hCtx, 
+                                             unsigned int row, 
+                                             unsigned int col )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    struct window * win = NULL;
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        if ( row < ctx->vis.height && col < ctx->vis.width )
+        {
+            /* The owners of the cells are only brought up to date when the
+               server draws a frame, so if the windows have changed since
+               then look through the windows as they are now, from the top */
+            if ( ctx->owners_stale )
+                win = ctx->top;
+            else
+                win = ctx->vis.owner[ ( row * ctx->vis.width ) + col ];
+            
+            /* The performance overlay is not one of the application's
+               windows, so look underneath it */
+            if ( win && ( ctx->owners_stale || win == ctx->hud ) )
+            {
+                for ( ; win; win = win->down )
+                    if ( win != ctx->hud && win->flag.visible
+                        && row >= win->row && row - win->row < win->height
+                        && col >= win->col && col - win->col < win->width )
+                        break;
+            }
+        }
+        
+        unlock_ctx( ctx );
+    }
+    
+    return (STUI_WINDOW_T)win;
+}
 
-    if ( !osal_mutex_obtain( &svr_lock, OSAL_SUSPEND_FOREVER ) )
+/*****************************************************************************/
+/**
+    Read the statistics the server keeps for a context.
+    
+    @param hCtx      Context handle.
+    @param stats     Pointer to store the statistics.
+**/
+extern void stui_context_get_stats( STUI_CONTEXT_T hCtx, STUI_STATS_T *stats )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    
+    if ( !lock_ctx( ctx ) )
     {
-        mark_dirty_overlapping( win, win );
+        *stats = ctx->stats;
+        unlock_ctx( ctx );
+    }
+}
+
+/*****************************************************************************/
+/**
+    Read the statistics the server keeps for the default context.
+    
+    @param stats     Pointer to store the statistics.
+**/
+extern void stui_get_stats( STUI_STATS_T *stats )
+{
+    stui_context_get_stats( NULL, stats );
+}
+
+/*****************************************************************************/
+/**
+    Show or hide the performance overlay on a context's screen.
+    
+    The overlay is drawn by the server on top of all the other windows, in
+    the top right corner of the screen.  It shows the frame rate, the bytes
+    sent to the terminal per frame, percentiles of the time taken to draw
+    recent frames, the time per frame spent in callbacks and holding the
+    lock, and the windows whose callbacks took the longest per call.  It is
+    updated at most every STUI_HUD_INTERVAL milliseconds, while frames are
+    being drawn, and describes the time since it was last updated.  Its own
+    callbacks are left out of the statistics, but the frames drawn to update
+    it, and the cells and bytes it sends, are counted along with the rest.
+    
+    @param hCtx      Context handle.
+    @param on        Non-zero to show the overlay, zero to hide it.
+**/
+extern void stui_context_set_hud( STUI_CONTEXT_T hCtx, int on )
+{
+    struct stui_context *ctx = get_context( hCtx );
+    struct window *win;
+    struct command cmd;
     
-        osal_mutex_release( &svr_lock );
+    if ( lock_ctx( ctx ) )
+        return;
+    
+    if ( on && !ctx->hud )
+    {
+        /* The overlay has id 0, which no application window has */
+        win = alloc_window( ctx, paint_hud, 0 );
+        if ( win )
+        {
+            ctx->hud = win;
+            osal_get_systime( NULL, &ctx->hud_time );
+            write_hud( ctx, ctx->hud_time );
+            
+            win->flag.visible = 1;
+            update_hud( ctx );
+        }
+    }
+    else if ( !on && ctx->hud )
+    {
+        cmd.op  = CMD_DESTROY;
+        cmd.win = ctx->hud;
+        ctx->hud = NULL;
+        run_command( &cmd );
     }
+    
+    unlock_ctx( ctx );
+}
+
+/*****************************************************************************/
+/**
+    Show or hide the performance overlay on the default context's screen.
+    
+    @param on        Non-zero to show the overlay, zero to hide it.
+**/
+extern void stui_set_hud( int on )
+{
+    stui_context_set_hud( NULL, on );
 }
 
 /*****************************************************************************/
@@ -580,6 +3532,30 @@ extern void stui_get_window_dims( STUI_WINDOW_T hWnd,
    if ( p_width )  *p_width  = win->width;
    if ( p_height ) *p_height = win->height;
 }
+
+/*****************************************************************************/
+/**
+    Get the number of times a window's callback has been called, and the
+    total time spent in it.
+    
+    @param hWnd      Handle to window to query.
+    @param p_calls   Pointer to store the number of calls.  Can be NULL.
+    @param p_us      Pointer to store the time in microseconds.  Can be NULL.
+**/
+extern void stui_get_window_stats( STUI_WINDOW_T hWnd, 
+                                   unsigned long *p_calls, 
+                                   unsigned long *p_us )
+{
+    struct window * win = (struct window *)hWnd;
+    struct stui_context *ctx = win->ctx;
+    
+    if ( !lock_ctx( ctx ) )
+    {
+        if ( p_calls ) *p_calls = win->calls;
+        if ( p_us )    *p_us    = win->us;
+        unlock_ctx( ctx );
+    }
+}
                                   
 /*****************************************************************************/
 /*****************************************************************************/
@@ -603,15 +3579,120 @@ extern void stui_cb_putchar( STUI_WINDOW_T hWnd,
                              STUI_CHAR_T c )
 {
     struct window * win = (struct window *)hWnd;
+    struct stui_context *ctx = win->ctx;
     
-    if ( row < win->height && col < win->width 
-    && ( win->row + row ) < vis.height 
-    && ( win->col + col ) < vis.width )
+    if ( win->bbuf )
+    {
+        if ( row >= win->paint.clip.top && row < win->paint.clip.bottom 
+            && col >= win->paint.clip.left && col < win->paint.clip.right )
+            win->bbuf[ ( row * win->paint.width ) + col ] = c;
+    }
+    else if ( row < win->paint.height && col < win->paint.width )
     {
-        vis.vbuf[ ( ( win->row + row ) * vis.width ) + ( win->col + col ) ] = c;
+        row += win->paint.row;
+        col += win->paint.col;
+        
+        if ( row >= win->paint.clip.top && row < win->paint.clip.bottom 
+            && col >= win->paint.clip.left && col < win->paint.clip.right
+            && ctx->vis.owner[ ( row * ctx->vis.width ) + col ] == win )
+            ctx->vis.vbuf[ ( row * ctx->vis.width ) + col ] = c;
     }
 }
 
+/*****************************************************************************/
+/**
+    Put a row of characters into the visual buffer for a given window.
+    
+    CAUTION: this function must only be called from within a callback context.
+    
+    @param hWnd      Handle to window to write to.
+    @param row       Row, relative to top-left window, to start output.
+    @param col       Column, relative to top-left window, to start output.
+    @param s         Attributed characters to put.
+    @param n         Number of characters.
+**/
+extern void stui_cb_write_span( STUI_WINDOW_T hWnd, 
+                                unsigned int row, unsigned int col, 
+                                const STUI_CHAR_T *s, unsigned int n )
+{
+    put_span( (struct window *)hWnd, row, col, s, n );
+}
+
+/*****************************************************************************/
+/**
+    Put a string into the visual buffer for a given window.
+    
+    CAUTION: this function must only be called from within a callback context.
+    
+    @param hWnd      Handle to window to write to.
+    @param row       Row, relative to top-left window, to start output.
+    @param col       Column, relative to top-left window, to start output.
+    @param attr      Character attributes to apply to the string.
+    @param text      Nul-terminated string.
+**/
+extern void stui_cb_write_text( STUI_WINDOW_T hWnd, 
+                                unsigned int row, unsigned int col, 
+                                STUI_CHAR_T attr, const char *text )
+{
+    put_text( (struct window *)hWnd, row, col, attr, text, 
+              (unsigned int)strlen( text ) );
+}
+
+/*****************************************************************************/
+/**
+    Fill a rectangle of a window with one character.
+    
+    CAUTION: this function must only be called from within a callback context.
+    
+    @param hWnd      Handle to window to write to.
+    @param row       Row, relative to top-left window, of top of rectangle.
+    @param col       Column, relative to top-left window, of left of 
+                     rectangle.
+    @param width     Width of rectangle.
+    @param height    Height of rectangle.
+    @param c         Attributed character to fill with.
+**/
+extern void stui_cb_fill_rect( STUI_WINDOW_T hWnd, 
+                               unsigned int row, unsigned int col, 
+                               unsigned int width, unsigned int height,
+                               STUI_CHAR_T c )
+{
+    struct window * win = (struct window *)hWnd;
+    unsigned int end;
+    
+    end = row + MIN( height, win->paint.height - MIN( row, win->paint.height ) );
+    for ( ; row < end; row++ )
+        fill_span( win, row, col, c, width );
+}
+
+/*****************************************************************************/
+/**
+    Copy a rectangle of characters into the visual buffer for a given window.
+    
+    CAUTION: this function must only be called from within a callback context.
+    
+    @param hWnd      Handle to window to write to.
+    @param row       Row, relative to top-left window, of top of rectangle.
+    @param col       Column, relative to top-left window, of left of 
+                     rectangle.
+    @param width     Width of rectangle.
+    @param height    Height of rectangle.
+    @param src       Attributed characters to copy, row by row.
+    @param stride    Distance between the start of each row in src.
+**/
+extern void stui_cb_blit( STUI_WINDOW_T hWnd, 
+                          unsigned int row, unsigned int col, 
+                          unsigned int width, unsigned int height,
+                          const STUI_CHAR_T *src, unsigned int stride )
+{
+    struct window * win = (struct window *)hWnd;
+    unsigned int end;
+    
+    end = row + MIN( height, win->paint.height - MIN( row, win->paint.height ) );
+    for ( ; row < end; row++, src += stride )
+        put_span( win, row, col, src, width );
+}
+
 #if defined( STUI_USE_FORMAT )
 
 #include "modules/format/src/format.h"
@@ -624,16 +3705,14 @@ struct cb_out {
     unsigned int col;
 };
 
-/** wrapper function for format that uses user data to then call stui_cb_putchar **/
-static void * wrapper_putchar( void *ptr, const char *s, size_t n  )
+/** wrapper function for format that writes each span of output in one go **/
+static void * wrapper_put_text( void *ptr, const char *s, size_t n  )
 {
    struct cb_out * p = (struct cb_out *)ptr;
-   while ( n )
-   {
-      stui_cb_putchar( p->hWnd, p->row, p->col, *s++ | p->attr );
-      p->col++;
-      n--;
-   }
+   
+   put_text( (struct window *)p->hWnd, p->row, p->col, p->attr, s, 
+             (unsigned int)MIN( n, UINT_MAX ) );
+   p->col += (unsigned int)MIN( n, UINT_MAX );
 
    return ptr;
 }
@@ -664,7 +3743,7 @@ extern void stui_cb_printf( STUI_WINDOW_T hWnd,
 
    va_start( ap, fmt );
 
-   format( wrapper_putchar, &udata, fmt, ap );
+   format( wrapper_put_text, &udata, fmt, ap );
 
    va_end( ap );
 }
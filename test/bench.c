@@ -0,0 +1,409 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/*
+   Compositor benchmark.
+   
+   Drives the server on the memory driver through a set of scenarios, each
+   a number of windows on a screen of a given size, with the windows
+   covering the screen a given number of times over.  Every frame a number
+   of windows are moved, raised and repainted, and the benchmark waits for
+   the server to present the result before starting the next frame.  A
+   small window showing the frame number is kept on top, so that every
+   frame changes something.  For each scenario it reports:
+   
+     fps        frames presented per second
+     cb/f       callbacks per frame
+     cells/f    cells painted by the callbacks per frame
+     bytes/f    bytes the xterm encoder produced per frame
+     us/call    average time taken by the calls that changed the windows,
+                which includes waiting for the server's lock
+     hold/f     microseconds the server's lock was held for per frame, by
+                the server and the application together
+     lat        average microseconds from the first change to a frame
+                being presented, from the server's statistics
+   
+   Usage: stui_bench [-t ms] [-w windows] [-s COLSxROWS] [-d density%]
+                     [-m moves] [-r raises] [-p repaints] [-R]
+   
+   With no options other than -t a standard set of scenarios is run, giving
+   scaling curves for the number of windows, the screen size, the amount of
+   overlap and the kind of change.  Otherwise a single scenario is run,
+   built from the options:
+   
+     -t ms         time to run each scenario for, 500 ms by default
+     -w windows    number of windows
+     -s COLSxROWS  screen size
+     -d density    total area of the windows, as a percentage of the screen
+     -m moves      windows moved per frame
+     -r raises     windows raised per frame
+     -p repaints   windows repainted per frame
+     -R            retain the contents of the windows
+*/
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "stui.h"
+#include "driver_api.h"
+#include "memory_driver.h"
+#include "osal/osal.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+/* Longest wait for a frame before giving up on it, in milliseconds */
+#define FRAME_TIMEOUT   ( 2000 )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+struct scenario {
+    const char *name;
+    unsigned int windows;
+    unsigned int cols, rows;
+    unsigned int density;
+    unsigned int moves, raises, repaints;
+    int retained;
+};
+
+/**
+   A window, and the work its callback has done.  A window is only ever
+   painted by one task at a time, so the counts need no lock.
+**/
+struct bwin {
+    STUI_WINDOW_T hWnd;
+    unsigned int width, height;
+    STUI_CHAR_T fill;
+    unsigned long calls, cells;
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+static unsigned int run_ms = 500;
+
+static const struct scenario suite[] = {
+    /* name         wins   cols rows  dens  mv  rs  rp  ret */
+    { "windows",        1,  200,  60,  200,  4,  1,  2,  0 },
+    { "windows",       10,  200,  60,  200,  4,  1,  2,  0 },
+    { "windows",      100,  200,  60,  200,  4,  1,  2,  0 },
+    { "windows",     1000,  200,  60,  200,  4,  1,  2,  0 },
+    { "windows",    10000,  200,  60,  200,  4,  1,  2,  0 },
+    { "retained",     100,  200,  60,  200,  4,  1,  2,  1 },
+    { "retained",   10000,  200,  60,  200,  4,  1,  2,  1 },
+    { "screen",       100,   80,  24,  200,  4,  1,  2,  0 },
+    { "screen",       100,  200,  60,  200,  4,  1,  2,  0 },
+    { "screen",       100,  500, 200,  200,  4,  1,  2,  0 },
+    { "overlap",      100,  200,  60,   50,  4,  1,  2,  0 },
+    { "overlap",      100,  200,  60, 1000,  4,  1,  2,  0 },
+    { "overlap",      100,  200,  60, 5000,  4,  1,  2,  0 },
+    { "move",         100,  200,  60,  200, 16,  0,  0,  0 },
+    { "raise",        100,  200,  60,  200,  0, 16,  0,  0 },
+    { "repaint",      100,  200,  60,  200,  0,  0, 16,  0 }
+};
+
+#define SUITE_LEN   ( sizeof(suite) / sizeof(suite[0]) )
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/** Elapsed microseconds since a time from osal_get_systime() **/
+static unsigned int since( unsigned int start )
+{
+    unsigned int now;
+    
+    osal_get_systime( NULL, &now );
+    return now - start;
+}
+
+/** Window callback: fill the dirty region, with a label on the top row **/
+static void paint( STUI_WINDOW_T hWnd, unsigned int tlr, unsigned int tlc, 
+                   unsigned int brr, unsigned int brc )
+{
+    struct bwin *bw = stui_get_userdata( hWnd );
+    
+    stui_cb_fill_rect( hWnd, tlr, tlc, brc - tlc, brr - tlr, bw->fill );
+    if ( 0 == tlr )
+        stui_cb_printf( hWnd, 0, 0, STUI_ATTR_REVERSE, "%ux%u", 
+                        bw->width, bw->height );
+    
+    bw->calls++;
+    bw->cells += ( brr - tlr ) * ( brc - tlc );
+}
+
+/** Ticker callback: show the frame number **/
+static void tick( STUI_WINDOW_T hWnd, unsigned int tlr, unsigned int tlc, 
+                  unsigned int brr, unsigned int brc )
+{
+    unsigned long *n = stui_get_userdata( hWnd );
+    
+    stui_cb_printf( hWnd, 0, 0, STUI_ATTR_BOLD, "%8lu", *n );
+}
+
+/** Integer square root **/
+static unsigned int isqrt( unsigned long n )
+{
+    unsigned long r = 0;
+    
+    while ( ( r + 1 ) * ( r + 1 ) <= n )
+        r++;
+    
+    return (unsigned int)r;
+}
+
+/** Run one scenario and print its line of results **/
+static void run( const struct scenario *sc )
+{
+    STUI_CONTEXT_T hCtx;
+    STUI_WINDOW_T ticker;
+    DRV_T drv;
+    struct bwin *wins;
+    STUI_STATS_T st0, st1;
+    char device[64];
+    unsigned long area, frames, first, f0, bytes0, calls = 0, cells = 0;
+    unsigned int i, k, start, elapsed, call_us = 0, n_calls = 0, t;
+    double hold = 0.0;
+    
+    sprintf( device, "%ux%u:xterm", sc->cols, sc->rows );
+    hCtx = stui_context_open_driver( "memory", device );
+    wins = calloc( sc->windows, sizeof(struct bwin) );
+    if ( !hCtx || !wins )
+    {
+        fprintf( stderr, "stui_bench: cannot set up %s\n", sc->name );
+        exit( 1 );
+    }
+    drv = stui_context_get_driver( hCtx );
+    stui_context_set_frame_interval( hCtx, 0 );
+    
+    /* Windows of equal size, three times as wide as they are high, that
+       between them cover the screen density% times over */
+    area = (unsigned long)sc->rows * sc->cols * sc->density / 100 / sc->windows;
+    srand( 1 );
+    
+    stui_context_begin_update( hCtx );
+    for ( i = 0; i < sc->windows; i++ )
+    {
+        struct bwin *bw = &wins[i];
+        
+        bw->width  = isqrt( area * 3 );
+        bw->width  = bw->width  ? ( bw->width < sc->cols ? bw->width : sc->cols ) : 1;
+        bw->height = area / bw->width;
+        bw->height = bw->height ? ( bw->height < sc->rows ? bw->height : sc->rows ) : 1;
+        bw->fill   = 'a' + ( i % 26 );
+        
+        bw->hWnd = stui_context_create_window( hCtx, paint, 
+                        sc->retained ? STUI_WINDOW_RETAINED : 0 );
+        if ( !bw->hWnd )
+        {
+            fprintf( stderr, "stui_bench: cannot create windows\n" );
+            exit( 1 );
+        }
+        
+        stui_set_userdata( bw->hWnd, bw );
+        stui_resize_window( bw->hWnd, bw->width, bw->height );
+        stui_move_window( bw->hWnd, rand() % ( sc->rows - bw->height + 1 ),
+                                    rand() % ( sc->cols - bw->width + 1 ) );
+        stui_show_window( bw->hWnd );
+    }
+    
+    ticker = stui_context_create_window( hCtx, tick, 0 );
+    if ( !ticker )
+    {
+        fprintf( stderr, "stui_bench: cannot create windows\n" );
+        exit( 1 );
+    }
+    stui_set_userdata( ticker, &f0 );
+    stui_resize_window( ticker, 8, 1 );
+    stui_raise_window( ticker );
+    stui_show_window( ticker );
+    stui_context_end_update( hCtx );
+    
+    /* Start measuring once the first frame is out of the way */
+    memdrv_wait_frames( drv, 1, FRAME_TIMEOUT );
+    for ( i = 0; i < sc->windows; i++ )
+        wins[i].calls = wins[i].cells = 0;
+    first  = f0 = memdrv_get_frames( drv );
+    bytes0 = memdrv_get_bytes( drv );
+    stui_context_get_stats( hCtx, &st0 );
+    
+    osal_get_systime( NULL, &start );
+    do {
+        osal_get_systime( NULL, &t );
+        
+        for ( k = 0; k < sc->moves; k++ )
+        {
+            struct bwin *bw = &wins[ rand() % sc->windows ];
+            
+            stui_move_window( bw->hWnd, rand() % ( sc->rows - bw->height + 1 ),
+                                        rand() % ( sc->cols - bw->width + 1 ) );
+        }
+        for ( k = 0; k < sc->raises; k++ )
+            stui_raise_window( wins[ rand() % sc->windows ].hWnd );
+        for ( k = 0; k < sc->repaints; k++ )
+            stui_repaint( wins[ rand() % sc->windows ].hWnd );
+        
+        call_us += since( t );
+        n_calls += sc->moves + sc->raises + sc->repaints;
+        
+        /* Bring the ticker up to date, which the server picks up along
+           with everything else */
+        f0++;
+        if ( sc->raises )
+            stui_raise_window( ticker );
+        stui_repaint( ticker );
+        
+        if ( memdrv_wait_frames( drv, f0, FRAME_TIMEOUT ) < f0 )
+            f0 = memdrv_get_frames( drv );
+        
+        elapsed = since( start );
+    } while ( elapsed < run_ms * 1000 );
+    
+    frames = memdrv_get_frames( drv ) - first;
+    stui_context_get_stats( hCtx, &st1 );
+    st1.frames -= st0.frames;
+    
+    /* Only a sample of the holds of the lock are timed */
+    if ( st1.locks_timed != st0.locks_timed )
+        hold = (double)( st1.lock_hold_us - st0.lock_hold_us )
+               * ( st1.locks - st0.locks ) / ( st1.locks_timed - st0.locks_timed );
+    
+    for ( i = 0; i < sc->windows; i++ )
+    {
+        calls += wins[i].calls;
+        cells += wins[i].cells;
+    }
+    
+    printf( "%-9s %6u %4ux%-4u %5u%% %8.1f %8.1f %10.1f %10.1f %8.2f %8.1f %8.1f\n",
+            sc->name, sc->windows, sc->cols, sc->rows, sc->density,
+            frames * 1e6 / elapsed, 
+            frames ? (double)calls / frames : 0.0,
+            frames ? (double)cells / frames : 0.0,
+            frames ? (double)( memdrv_get_bytes( drv ) - bytes0 ) / frames : 0.0,
+            n_calls ? (double)call_us / n_calls : 0.0,
+            frames ? hold / frames : 0.0,
+            st1.frames ? (double)( st1.latency_us - st0.latency_us ) / st1.frames : 0.0 );
+    fflush( stdout );
+    
+    stui_context_close( hCtx );
+    free( wins );
+}
+
+/*****************************************************************************/
+/* Public functions.                                                         */
+/*****************************************************************************/
+
+int main( int argc, char *argv[] )
+{
+    struct scenario custom = { "custom", 100, 200, 60, 200, 4, 1, 2, 0 };
+    int use_custom = 0;
+    unsigned int i;
+    
+    for ( i = 1; i < (unsigned int)argc; i++ )
+    {
+        const char *arg = ( i + 1 < (unsigned int)argc ) ? argv[i + 1] : NULL;
+        
+        if ( !strcmp( argv[i], "-R" ) )
+        {
+            custom.retained = 1;
+            use_custom = 1;
+            continue;
+        }
+        
+        if ( !arg )
+            break;
+        
+        if ( !strcmp( argv[i], "-t" ) )
+            run_ms = atoi( arg );
+        else if ( !strcmp( argv[i], "-w" ) )
+            custom.windows = atoi( arg );
+        else if ( !strcmp( argv[i], "-s" ) )
+        {
+            if ( 2 != sscanf( arg, "%ux%u", &custom.cols, &custom.rows ) )
+                break;
+        }
+        else if ( !strcmp( argv[i], "-d" ) )
+            custom.density = atoi( arg );
+        else if ( !strcmp( argv[i], "-m" ) )
+            custom.moves = atoi( arg );
+        else if ( !strcmp( argv[i], "-r" ) )
+            custom.raises = atoi( arg );
+        else if ( !strcmp( argv[i], "-p" ) )
+            custom.repaints = atoi( arg );
+        else
+            break;
+        
+        use_custom |= strcmp( argv[i], "-t" );
+        i++;
+    }
+    
+    if ( i != (unsigned int)argc || !custom.windows || !custom.rows 
+        || !custom.cols || !custom.density || !run_ms )
+    {
+        fprintf( stderr, "usage: stui_bench [-t ms] [-w windows] [-s COLSxROWS] "
+                         "[-d density%%]\n"
+                         "                  [-m moves] [-r raises] "
+                         "[-p repaints] [-R]\n" );
+        return 1;
+    }
+    
+    printf( "%-9s %6s %9s %6s %8s %8s %10s %10s %8s %8s %8s\n", "scenario", 
+            "wins", "screen", "dens", "fps", "cb/f", "cells/f", "bytes/f", 
+            "us/call", "hold/f", "lat" );
+    
+    if ( use_custom )
+        run( &custom );
+    else
+        for ( i = 0; i < SUITE_LEN; i++ )
+            run( &suite[i] );
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
@@ -0,0 +1,397 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/*
+   Golden frame tests.
+   
+   Drives the server on the memory driver through a few known layouts of
+   windows and compares each frame presented with the expected grid of
+   cells.  The windows fill themselves with a single letter, apart from a
+   window of numbered lines that is scrolled, so any cell left behind by a
+   window that has moved, or painted by a window that should be covered,
+   shows up.  Along the way it checks that stui_context_window_at() finds
+   the right window, including straight after windows have been changed and
+   before the change has been drawn.  The layouts are run with windows that
+   paint straight onto the screen and then with retained windows.
+   
+   Usage: stui_golden
+   
+   Prints a line for each frame checked, with the expected and actual
+   frames for any that do not match, and exits with status 1 if any failed.
+*/
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "stui.h"
+#include "driver_api.h"
+#include "memory_driver.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+/* Size of the screen */
+#define ROWS            ( 8 )
+#define COLS            ( 20 )
+
+/* Longest wait for a frame before giving up on it, in milliseconds */
+#define FRAME_TIMEOUT   ( 2000 )
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+static STUI_CONTEXT_T hCtx;
+static DRV_T drv;
+static unsigned int failures = 0;
+
+/** First line shown by the window of numbered lines **/
+static unsigned int first_line = 0;
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/** Window callback: fill the dirty region with the window's letter **/
+static void paint( STUI_WINDOW_T hWnd, unsigned int tlr, unsigned int tlc, 
+                   unsigned int brr, unsigned int brc )
+{
+    const char *fill = stui_get_userdata( hWnd );
+    
+    stui_cb_fill_rect( hWnd, tlr, tlc, brc - tlc, brr - tlr, *fill );
+}
+
+/** Window callback: number the dirty rows from first_line **/
+static void paint_lines( STUI_WINDOW_T hWnd, unsigned int tlr, unsigned int tlc, 
+                         unsigned int brr, unsigned int brc )
+{
+    char text[16];
+    unsigned int r;
+    
+    stui_cb_fill_rect( hWnd, tlr, tlc, brc - tlc, brr - tlr, ' ' );
+    for ( r = tlr; r < brr; r++ )
+    {
+        sprintf( text, "line %u", first_line + r );
+        stui_cb_write_text( hWnd, r, 0, 0, text );
+    }
+}
+
+/** Create a window filled with a letter, at a position and size **/
+static STUI_WINDOW_T make_window( const char *fill, unsigned int flags,
+                                  unsigned int row, unsigned int col,
+                                  unsigned int width, unsigned int height )
+{
+    STUI_WINDOW_T hWnd;
+    
+    hWnd = stui_context_create_window( hCtx, paint, flags );
+    if ( !hWnd )
+    {
+        fprintf( stderr, "stui_golden: cannot create window\n" );
+        exit( 1 );
+    }
+    
+    stui_set_userdata( hWnd, (void *)fill );
+    stui_resize_window( hWnd, width, height );
+    stui_move_window( hWnd, row, col );
+    stui_raise_window( hWnd );
+    stui_show_window( hWnd );
+    
+    return hWnd;
+}
+
+/** Print a frame, one row to a line **/
+static void dump( const char *label, const char * const *rows,
+                  const STUI_CHAR_T *cells )
+{
+    unsigned int r, c;
+    
+    printf( "  %s:\n", label );
+    for ( r = 0; r < ROWS; r++ )
+    {
+        printf( "    |" );
+        for ( c = 0; c < COLS; c++ )
+            putchar( rows ? rows[r][c] 
+                          : (int)( cells[ r * COLS + c ] & STUI_CHAR_MASK ) );
+        printf( "|\n" );
+    }
+}
+
+/** 
+    Check that the screen shows the expected frame.  The server may take
+    more than one frame to catch up, so frames are checked as they are
+    presented until one matches or no more arrive.
+**/
+static void expect( const char *name, const char * const *rows )
+{
+    STUI_CHAR_T cells[ROWS * COLS];
+    unsigned long frames;
+    unsigned int r, c;
+    int match;
+    
+    for (;;)
+    {
+        frames = memdrv_get_screen( drv, cells, NULL, NULL );
+        
+        match = 1;
+        for ( r = 0; r < ROWS && match; r++ )
+            for ( c = 0; c < COLS && match; c++ )
+                match = rows[r][c] == (char)( cells[ r * COLS + c ] & STUI_CHAR_MASK );
+        
+        if ( match || memdrv_wait_frames( drv, frames + 1, FRAME_TIMEOUT ) <= frames )
+            break;
+    }
+    
+    printf( "%s %s\n", match ? "PASS" : "FAIL", name );
+    if ( !match )
+    {
+        dump( "expected", rows, NULL );
+        dump( "actual", NULL, cells );
+        failures++;
+    }
+}
+
+/** Check that the window at a position on the screen is the expected one **/
+static void expect_at( const char *name, unsigned int row, unsigned int col,
+                       STUI_WINDOW_T want )
+{
+    STUI_WINDOW_T got = stui_context_window_at( hCtx, row, col );
+    
+    printf( "%s %s\n", got == want ? "PASS" : "FAIL", name );
+    if ( got != want )
+        failures++;
+}
+
+/** Run the layouts with windows created with the given flags **/
+static void run( unsigned int flags )
+{
+    static const char * const overlap[ROWS] = {
+        "                    ",
+        " aaaaaaaa           ",
+        " aaaabbbbbbbb       ",
+        " aaaabbbbbbbb       ",
+        " aaaabbbbbbbb       ",
+        "     bbbbbbbb       ",
+        "                    ",
+        "                    "
+    };
+    static const char * const moved[ROWS] = {
+        "                    ",
+        " aaaaaaaa           ",
+        " aaaaaaaa           ",
+        " aaaaaaaa           ",
+        " aaaaaaaa bbbbbbbb  ",
+        "          bbbbbbbb  ",
+        "          bbbbbbbb  ",
+        "          bbbbbbbb  "
+    };
+    static const char * const moved_back[ROWS] = {
+        "                    ",
+        " aaaaaaaa           ",
+        " aaaaaaaa           ",
+        " aaaaabbbbbbbb      ",
+        " aaaaabbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "                    "
+    };
+    static const char * const raised[ROWS] = {
+        "                    ",
+        " aaaaaaaa           ",
+        " aaaaaaaa           ",
+        " aaaaaaaabbbbb      ",
+        " aaaaaaaabbbbb      ",
+        "      bbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "                    "
+    };
+    static const char * const destroyed[ROWS] = {
+        "                    ",
+        "                    ",
+        "                    ",
+        "      bbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "      bbbbbbbb      ",
+        "                    "
+    };
+    static const char * const lines[ROWS] = {
+        "                    ",
+        "line 0              ",
+        "line 1              ",
+        "line 2              ",
+        "line 3              ",
+        "line 4              ",
+        "line 5              ",
+        "                    "
+    };
+    static const char * const scrolled_up[ROWS] = {
+        "                    ",
+        "line 2              ",
+        "line 3              ",
+        "line 4              ",
+        "line 5              ",
+        "line 6              ",
+        "line 7              ",
+        "                    "
+    };
+    static const char * const scrolled_down[ROWS] = {
+        "                    ",
+        "line 1              ",
+        "line 2              ",
+        "line 3              ",
+        "line 4              ",
+        "line 5              ",
+        "line 6              ",
+        "                    "
+    };
+    static const char * const empty[ROWS] = {
+        "                    ",
+        "                    ",
+        "                    ",
+        "                    ",
+        "                    ",
+        "                    ",
+        "                    ",
+        "                    "
+    };
+    STUI_WINDOW_T a, b, l;
+    
+    printf( "%s windows\n", flags & STUI_WINDOW_RETAINED ? "retained" : "direct" );
+    
+    stui_context_begin_update( hCtx );
+    a = make_window( "a", flags, 1, 1, 8, 4 );
+    b = make_window( "b", flags, 2, 5, 8, 4 );
+    stui_context_end_update( hCtx );
+    expect( "overlap", overlap );
+    expect_at( "window at overlap", 3, 6, b );
+    expect_at( "window at edge", 1, 1, a );
+    expect_at( "window at nothing", 0, 0, NULL );
+    
+    /* No frame is drawn during the update, so the windows are found as
+       they are now rather than as they were last drawn */
+    stui_context_begin_update( hCtx );
+    stui_move_window( b, 4, 10 );
+    expect_at( "window at uncovered", 3, 6, a );
+    expect_at( "window at moved", 6, 15, b );
+    stui_context_end_update( hCtx );
+    expect( "move apart", moved );
+    
+    stui_move_window( b, 3, 6 );
+    expect( "move over", moved_back );
+    
+    stui_raise_window( a );
+    expect( "raise", raised );
+    
+    expect_at( "window at raised", 3, 8, a );
+    
+    stui_context_begin_update( hCtx );
+    stui_destroy_window( a );
+    expect_at( "window at destroyed", 1, 1, NULL );
+    expect_at( "window at exposed", 3, 8, b );
+    stui_context_end_update( hCtx );
+    expect( "destroy", destroyed );
+    
+    /* A window of numbered lines across the whole screen, which is scrolled
+       by the terminal */
+    stui_context_begin_update( hCtx );
+    stui_destroy_window( b );
+    first_line = 0;
+    l = stui_context_create_window( hCtx, paint_lines, flags );
+    if ( !l )
+    {
+        fprintf( stderr, "stui_golden: cannot create window\n" );
+        exit( 1 );
+    }
+    stui_resize_window( l, COLS, 6 );
+    stui_move_window( l, 1, 0 );
+    stui_show_window( l );
+    stui_context_end_update( hCtx );
+    expect( "lines", lines );
+    
+    stui_context_begin_update( hCtx );
+    first_line += 2;
+    stui_scroll_window( l, 2 );
+    stui_context_end_update( hCtx );
+    expect( "scroll up", scrolled_up );
+    
+    stui_context_begin_update( hCtx );
+    first_line -= 1;
+    stui_scroll_window( l, -1 );
+    stui_context_end_update( hCtx );
+    expect( "scroll down", scrolled_down );
+    
+    stui_destroy_window( l );
+    expect( "empty", empty );
+}
+
+/*****************************************************************************/
+/* Public functions.                                                         */
+/*****************************************************************************/
+
+int main( void )
+{
+    char device[32];
+    
+    sprintf( device, "%ux%u", COLS, ROWS );
+    hCtx = stui_context_open_driver( "memory", device );
+    if ( !hCtx )
+    {
+        fprintf( stderr, "stui_golden: cannot open memory screen\n" );
+        return 1;
+    }
+    drv = stui_context_get_driver( hCtx );
+    stui_context_set_frame_interval( hCtx, 0 );
+    
+    run( 0 );
+    run( STUI_WINDOW_RETAINED );
+    
+    stui_context_close( hCtx );
+    
+    printf( "%u failed\n", failures );
+    return failures ? 1 : 0;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
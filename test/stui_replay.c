@@ -0,0 +1,418 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/*
+   Replays a recording made with the recording driver through any driver,
+   and reports how long the driver took to present it.
+   
+   Usage: stui_replay [-f] [-d driver] [-D device] file
+   
+     -f          replay as fast as possible, rather than in real time
+     -d driver   driver to present the frames with, memory by default
+     -D device   device for the driver.  For the memory driver the default
+                 is a screen the size of the recording, with the output
+                 run through the xterm encoder so that it can be measured.
+   
+   The screen must be the same size as the recording.  Only the memory
+   driver can follow a recording that changes size.
+*/
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "stui.h"
+#include "driver_api.h"
+#include "memory_driver.h"
+#include "record.h"
+#include "osal/osal.h"
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   Replay state.  The screen holds what has been presented so far, and is
+   what is handed to the driver.
+**/
+struct replay {
+    FILE *fp;
+    
+    const struct drv_ops *ops;
+    DRV_T drv;
+    
+    unsigned int rows, cols;
+    STUI_CHAR_T *screen;
+    struct drv_run *runs;
+    unsigned int max_runs;
+    int scrolled;
+    
+    /* Totals */
+    unsigned long frames, cells;
+    unsigned long recorded_us, driver_us;
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+static int fast = 0;
+static const char *driver = "memory";
+static const char *device = NULL;
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+static void fail( const char *msg )
+{
+    fprintf( stderr, "stui_replay: %s\n", msg );
+    exit( 1 );
+}
+
+/** Read an unsigned LEB128 number **/
+static unsigned long get_uint( FILE *fp )
+{
+    unsigned long v = 0;
+    unsigned int shift = 0;
+    int c;
+    
+    do {
+        c = getc( fp );
+        if ( EOF == c )
+            fail( "recording is truncated" );
+        v |= (unsigned long)( c & 0x7F ) << shift;
+        shift += 7;
+    } while ( c & 0x80 );
+    
+    return v;
+}
+
+/** Read a zigzag encoded signed number **/
+static int get_int( FILE *fp )
+{
+    unsigned long v = get_uint( fp );
+    
+    return ( v & 1 ) ? -(int)( ( v + 1 ) / 2 ) : (int)( v / 2 );
+}
+
+/** Read cells, low byte first **/
+static void get_cells( FILE *fp, STUI_CHAR_T *cells, unsigned int n )
+{
+    int lo, hi;
+    
+    while ( n-- )
+    {
+        lo = getc( fp );
+        hi = getc( fp );
+        if ( EOF == lo || EOF == hi )
+            fail( "recording is truncated" );
+        *cells++ = (STUI_CHAR_T)( lo | ( hi << 8 ) );
+    }
+}
+
+/** Elapsed microseconds since a time from osal_get_systime() **/
+static unsigned int since( unsigned int start )
+{
+    unsigned int now;
+    
+    osal_get_systime( NULL, &now );
+    return now - start;
+}
+
+/** Open the driver, or bring it up to date, for a screen of the given size **/
+static void set_size( struct replay *rp, unsigned int rows, unsigned int cols )
+{
+    unsigned int drows, dcols, i;
+    static char buf[64];
+    
+    if ( !rows || !cols )
+        fail( "bad screen size in recording" );
+    
+    free( rp->screen );
+    free( rp->runs );
+    rp->rows     = rows;
+    rp->cols     = cols;
+    rp->max_runs = rows * ( ( cols + 1 ) / 2 );
+    rp->screen   = malloc( rows * cols * sizeof(STUI_CHAR_T) );
+    rp->runs     = malloc( rp->max_runs * sizeof(struct drv_run) );
+    if ( !rp->screen || !rp->runs )
+        fail( "out of memory" );
+    
+    for ( i = 0; i < rows * cols; i++ )
+        rp->screen[i] = ' ';
+    
+    if ( !rp->drv )
+    {
+        if ( !device && rp->ops == &memory_driver )
+        {
+            sprintf( buf, "%ux%u:xterm", cols, rows );
+            device = buf;
+        }
+        
+        rp->drv = rp->ops->open( device );
+        if ( !rp->drv )
+            fail( "cannot open driver" );
+    }
+    else if ( rp->ops == &memory_driver )
+        memdrv_resize( rp->drv, rows, cols );
+    
+    rp->ops->get_screen_size( rp->drv, &drows, &dcols );
+    if ( drows != rows || dcols != cols )
+    {
+        fprintf( stderr, "stui_replay: recording is %u x %u but screen is %u x %u\n",
+                 rows, cols, drows, dcols );
+        exit( 1 );
+    }
+}
+
+/** Scroll rows of the screen, as the terminal would **/
+static void scroll( struct replay *rp, unsigned int top, unsigned int bottom, int n )
+{
+    unsigned int rows = ( n < 0 ) ? (unsigned int)-n : (unsigned int)n;
+    STUI_CHAR_T *blank;
+    unsigned int i;
+    
+    if ( bottom > rp->rows || top >= bottom || rows >= bottom - top )
+        fail( "bad scroll in recording" );
+    
+    if ( n > 0 )
+    {
+        memmove( rp->screen + top * rp->cols, 
+                 rp->screen + ( top + rows ) * rp->cols,
+                 ( bottom - top - rows ) * rp->cols * sizeof(STUI_CHAR_T) );
+        blank = rp->screen + ( bottom - rows ) * rp->cols;
+    }
+    else
+    {
+        memmove( rp->screen + ( top + rows ) * rp->cols, 
+                 rp->screen + top * rp->cols,
+                 ( bottom - top - rows ) * rp->cols * sizeof(STUI_CHAR_T) );
+        blank = rp->screen + top * rp->cols;
+    }
+    
+    for ( i = 0; i < rows * rp->cols; i++ )
+        blank[i] = ' ';
+    
+    if ( rp->ops->caps & DRV_CAP_SCROLL )
+    {
+        unsigned int start;
+        
+        osal_get_systime( NULL, &start );
+        rp->ops->scroll( rp->drv, top, bottom, n );
+        rp->driver_us += since( start );
+    }
+    
+    rp->scrolled = 1;
+}
+
+/** Read a frame of runs into the screen, returning the number of runs **/
+static unsigned int read_runs( struct replay *rp )
+{
+    unsigned int n, i;
+    struct drv_run *run;
+    
+    n = get_uint( rp->fp );
+    if ( n > rp->max_runs )
+        fail( "bad frame in recording" );
+    
+    for ( i = 0; i < n; i++ )
+    {
+        run = &rp->runs[i];
+        run->row = get_uint( rp->fp );
+        run->col = get_uint( rp->fp );
+        run->len = get_uint( rp->fp );
+        if ( run->row >= rp->rows || run->col + run->len > rp->cols )
+            fail( "bad frame in recording" );
+        
+        get_cells( rp->fp, rp->screen + ( run->row * rp->cols ) + run->col, 
+                   run->len );
+        rp->cells += run->len;
+    }
+    
+    return n;
+}
+
+/** Present the frame read into the screen, in the best way the driver has **/
+static void present( struct replay *rp, int type, unsigned int n )
+{
+    const struct drv_ops *ops = rp->ops;
+    unsigned int start;
+    
+    osal_get_systime( NULL, &start );
+    
+    if ( ops->caps & DRV_CAP_SYNC )
+        ops->begin_frame( rp->drv );
+    
+    if ( REC_RUNS == type && ( ops->caps & DRV_CAP_DIFF )
+        && ( !rp->scrolled || ( ops->caps & DRV_CAP_SCROLL ) ) )
+        ops->put_runs( rp->drv, rp->screen, rp->runs, n );
+    else
+        ops->put_screen( rp->drv, rp->screen );
+    
+    if ( ops->caps & DRV_CAP_SYNC )
+        ops->end_frame( rp->drv );
+    
+    rp->driver_us += since( start );
+    rp->scrolled = 0;
+    rp->frames++;
+}
+
+static void replay( struct replay *rp )
+{
+    unsigned int start, dt, n = 0;
+    unsigned long due = 0;
+    char magic[REC_MAGIC_LEN];
+    int type;
+    
+    if ( fread( magic, 1, REC_MAGIC_LEN, rp->fp ) != REC_MAGIC_LEN
+        || memcmp( magic, REC_MAGIC, REC_MAGIC_LEN ) )
+        fail( "not a recording" );
+    
+    if ( REC_SIZE != getc( rp->fp ) )
+        fail( "recording does not start with the screen size" );
+    n = get_uint( rp->fp );
+    set_size( rp, n, get_uint( rp->fp ) );
+    
+    osal_get_systime( NULL, &start );
+    
+    while ( EOF != ( type = getc( rp->fp ) ) )
+    {
+        switch ( type )
+        {
+        case REC_SIZE:
+            n = get_uint( rp->fp );
+            set_size( rp, n, get_uint( rp->fp ) );
+            break;
+        
+        case REC_SCROLL:
+            {
+                unsigned int top    = get_uint( rp->fp );
+                unsigned int bottom = get_uint( rp->fp );
+                
+                scroll( rp, top, bottom, get_int( rp->fp ) );
+            }
+            break;
+        
+        case REC_RUNS:
+        case REC_SCREEN:
+            dt = get_uint( rp->fp );
+            if ( REC_RUNS == type )
+                n = read_runs( rp );
+            else
+            {
+                get_cells( rp->fp, rp->screen, rp->rows * rp->cols );
+                rp->cells += rp->rows * rp->cols;
+            }
+            
+            /* Keep to the recorded timing, unless told to go flat out */
+            rp->recorded_us += dt;
+            due += dt;
+            if ( !fast && due > since( start ) + 1000 )
+                osal_task_sleep( ( due - since( start ) ) / 1000 );
+            
+            present( rp, type, n );
+            break;
+        
+        default:
+            fail( "bad record in recording" );
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Public functions.                                                         */
+/*****************************************************************************/
+
+int main( int argc, char *argv[] )
+{
+    struct replay rp;
+    int i;
+    
+    memset( &rp, 0, sizeof(rp) );
+    
+    for ( i = 1; i < argc - 1; i++ )
+    {
+        if ( !strcmp( argv[i], "-f" ) )
+            fast = 1;
+        else if ( !strcmp( argv[i], "-d" ) && i + 2 < argc )
+            driver = argv[++i];
+        else if ( !strcmp( argv[i], "-D" ) && i + 2 < argc )
+            device = argv[++i];
+        else
+            break;
+    }
+    
+    if ( i != argc - 1 )
+    {
+        fprintf( stderr, "usage: stui_replay [-f] [-d driver] [-D device] file\n" );
+        return 1;
+    }
+    
+    rp.ops = drv_find( driver );
+    if ( !rp.ops )
+        fail( "no such driver" );
+    
+    rp.fp = fopen( argv[i], "rb" );
+    if ( !rp.fp )
+        fail( "cannot open recording" );
+    
+    replay( &rp );
+    fclose( rp.fp );
+    
+    fprintf( stderr, "%lu frames, %lu cells, %.3f s recorded\n", 
+             rp.frames, rp.cells, rp.recorded_us / 1e6 );
+    fprintf( stderr, "%.3f ms in driver", rp.driver_us / 1e3 );
+    if ( rp.ops == &memory_driver )
+        fprintf( stderr, ", %lu bytes encoded", memdrv_get_bytes( rp.drv ) );
+    fprintf( stderr, "\n" );
+    
+    rp.ops->close( rp.drv );
+    free( rp.screen );
+    free( rp.runs );
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
@@ -27,28 +27,20 @@ void callback_topwin( STUI_WINDOW_T hWnd, unsigned int tl_row, unsigned int tl_c
    stui_cb_putchar( hWnd, h-2, 0, '+' );
    stui_cb_putchar( hWnd, h-2, w-2, '+' );
 	
-	for ( y = 1; y < h-2; y++ )
-		for ( x = 1; x < w-2; x++ )
-			stui_cb_putchar( hWnd, y, x, 'X' );
+	stui_cb_fill_rect( hWnd, 1, 1, w-3, h-3, 'X' );
 }
 
 void callback_rootwin( STUI_WINDOW_T hWnd, unsigned int tl_row, unsigned int tl_col, unsigned int br_row, unsigned int br_col )
 {
-	unsigned int x, y;
-	
-	for ( y = tl_row; y < br_row; y++ )
-		for ( x = tl_col; x < br_col; x++ )
-			stui_cb_putchar( hWnd, y, x, '.' );
+	stui_cb_fill_rect( hWnd, tl_row, tl_col, br_col - tl_col, br_row - tl_row, '.' );
 }
 
 
 void callback_hello( STUI_WINDOW_T hWnd, unsigned int tl_row, unsigned int tl_col, unsigned int br_row, unsigned int br_col )
 {
-	unsigned int x, y;
+	unsigned int y;
 	
-	for ( y = tl_row; y < br_row; y++ )
-		for ( x = tl_col; x < br_col; x++ )
-			stui_cb_putchar( hWnd, y, x, ' ' );
+	stui_cb_fill_rect( hWnd, tl_row, tl_col, br_col - tl_col, br_row - tl_row, ' ' );
 	
    stui_cb_printf( hWnd, 0, 0, 0, "%.20C#" );
    stui_cb_printf( hWnd, 9, 0, 0, "%.20C#" );
@@ -77,6 +69,10 @@ int main( void )
        return 1;
     }
     
+    /* The window is moved far more often than frames are drawn, so let the
+       server catch up with the moves once per frame */
+    stui_set_async( 1 );
+    
     rootwin = stui_create_window( callback_rootwin );
     stui_resize_window( rootwin, 0, 0 );
     stui_show_window( rootwin );
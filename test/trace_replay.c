@@ -0,0 +1,454 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/*
+   Replays a trace of API calls, made with stui_trace_start() or the
+   STUI_TRACE environment variable, on the memory driver, and reports how
+   long the server took to present it.
+   
+   Usage: trace_replay [-r] [-i ms] file
+   
+     -r          keep to the timing of the trace, rather than making the
+                 calls as fast as possible
+     -i ms       use this frame interval for all contexts, in place of the
+                 ones in the trace.  0 presents a frame for every change.
+   
+   The windows' callbacks are not part of the trace, so each window is
+   painted with a letter standing for the window, one cell at a time.  The
+   output of the memory driver is run through the xterm encoder, so the
+   number of bytes a terminal would have been sent is reported too.  When
+   the trace closes a context, the server is left to present the work queued
+   for it first, so that it is counted.
+*/
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "stui.h"
+#include "driver_api.h"
+#include "memory_driver.h"
+#include "osal/osal.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+#define MAX_LINE        ( 256 )
+
+/* The server is taken to have finished once it has presented no frames for
+   this long */
+#define IDLE_MS         ( 200 )
+#define POLL_MS         ( 5 )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   A context in the trace, and its windows, indexed by their numbers.
+**/
+struct context {
+    STUI_CONTEXT_T hCtx;
+    STUI_WINDOW_T *wins;
+    unsigned int n_wins;
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+static int real_time = 0;
+static int frame_interval = -1;
+
+static struct context *contexts = NULL;
+static unsigned int n_contexts = 0;
+
+/* Frames presented and bytes encoded by the contexts already closed, and
+   the time spent waiting to be sure they were idle, which is left out of the
+   times reported */
+static unsigned long closed_frames = 0, closed_bytes = 0;
+static unsigned int idle_us = 0;
+
+/* Work done by the callbacks, which may run on several tasks */
+static osal_mutex_t count_lock;
+static unsigned long callbacks = 0, cells = 0;
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+static void fail( unsigned int line, const char *msg )
+{
+    fprintf( stderr, "trace_replay: line %u: %s\n", line, msg );
+    exit( 1 );
+}
+
+/** Elapsed microseconds since a time from osal_get_systime() **/
+static unsigned int since( unsigned int start )
+{
+    unsigned int now;
+    
+    osal_get_systime( NULL, &now );
+    return now - start;
+}
+
+/** Window callback: paint the dirty region with the window's letter **/
+static void paint( STUI_WINDOW_T hWnd, unsigned int tlr, unsigned int tlc, 
+                   unsigned int brr, unsigned int brc )
+{
+    unsigned int id = (unsigned int)(size_t)stui_get_userdata( hWnd );
+    unsigned int row, col;
+    
+    for ( row = tlr; row < brr; row++ )
+        for ( col = tlc; col < brc; col++ )
+            stui_cb_putchar( hWnd, row, col, 'A' + ( id % 26 ) );
+    
+    if ( !osal_mutex_obtain( &count_lock, OSAL_SUSPEND_FOREVER ) )
+    {
+        callbacks++;
+        cells += ( brr - tlr ) * ( brc - tlc );
+        osal_mutex_release( &count_lock );
+    }
+}
+
+/** Find a context by number **/
+static struct context * find_context( unsigned int line, unsigned int id )
+{
+    if ( !id || id > n_contexts || !contexts[id - 1].hCtx )
+        fail( line, "no such context" );
+    
+    return &contexts[id - 1];
+}
+
+/** Find a window given as context:window **/
+static STUI_WINDOW_T find_window( unsigned int line, const char *ref )
+{
+    struct context *ctx;
+    unsigned int c, w;
+    
+    if ( 2 != sscanf( ref, "%u:%u", &c, &w ) )
+        fail( line, "bad window" );
+    
+    ctx = find_context( line, c );
+    if ( !w || w > ctx->n_wins || !ctx->wins[w - 1] )
+        fail( line, "no such window" );
+    
+    return ctx->wins[w - 1];
+}
+
+/** Open the context with the given number **/
+static void open_context( unsigned int line, unsigned int id, 
+                          unsigned int rows, unsigned int cols )
+{
+    char device[64];
+    
+    if ( !id )
+        fail( line, "bad context" );
+    
+    if ( id > n_contexts )
+    {
+        contexts = realloc( contexts, id * sizeof(struct context) );
+        if ( !contexts )
+            fail( line, "out of memory" );
+        memset( contexts + n_contexts, 0, 
+                ( id - n_contexts ) * sizeof(struct context) );
+        n_contexts = id;
+    }
+    
+    sprintf( device, "%ux%u:xterm", cols, rows );
+    contexts[id - 1].hCtx = stui_context_open_driver( "memory", device );
+    if ( !contexts[id - 1].hCtx )
+        fail( line, "cannot open context" );
+    
+    if ( frame_interval >= 0 )
+        stui_context_set_frame_interval( contexts[id - 1].hCtx, frame_interval );
+}
+
+/**
+    Close a context once the server has finished presenting the work queued
+    for it, keeping its frames and bytes in the totals.
+**/
+static void close_context( struct context *ctx )
+{
+    DRV_T drv = stui_context_get_driver( ctx->hCtx );
+    unsigned long frames, prev;
+    unsigned int i, last;
+    
+    osal_get_systime( NULL, &last );
+    prev = memdrv_get_frames( drv );
+    for ( i = 0; i < IDLE_MS / POLL_MS; i++ )
+    {
+        osal_task_sleep( POLL_MS );
+        frames = memdrv_get_frames( drv );
+        if ( frames != prev )
+        {
+            osal_get_systime( NULL, &last );
+            prev = frames;
+            i = 0;
+        }
+    }
+    idle_us += since( last );
+    
+    closed_frames += memdrv_get_frames( drv );
+    closed_bytes  += memdrv_get_bytes( drv );
+    
+    stui_context_close( ctx->hCtx );
+    ctx->hCtx = NULL;
+    free( ctx->wins );
+    ctx->wins   = NULL;
+    ctx->n_wins = 0;
+}
+
+/** Create a window given as context:window **/
+static void create_window( unsigned int line, const char *ref, unsigned int flags )
+{
+    struct context *ctx;
+    unsigned int c, w;
+    
+    if ( 2 != sscanf( ref, "%u:%u", &c, &w ) || !w )
+        fail( line, "bad window" );
+    
+    ctx = find_context( line, c );
+    if ( w > ctx->n_wins )
+    {
+        ctx->wins = realloc( ctx->wins, w * sizeof(STUI_WINDOW_T) );
+        if ( !ctx->wins )
+            fail( line, "out of memory" );
+        memset( ctx->wins + ctx->n_wins, 0, 
+                ( w - ctx->n_wins ) * sizeof(STUI_WINDOW_T) );
+        ctx->n_wins = w;
+    }
+    
+    ctx->wins[w - 1] = stui_context_create_window( ctx->hCtx, paint, flags );
+    if ( !ctx->wins[w - 1] )
+        fail( line, "cannot create window" );
+    stui_set_userdata( ctx->wins[w - 1], (void *)(size_t)w );
+}
+
+/** Carry out one line of the trace **/
+static void run( unsigned int line, const char *call, const char *ref, 
+                 unsigned int a, unsigned int b )
+{
+    if ( !strcmp( call, "context_open" ) )
+        open_context( line, strtoul( ref, NULL, 10 ), a, b );
+    else if ( !strcmp( call, "context_close" ) )
+        close_context( find_context( line, strtoul( ref, NULL, 10 ) ) );
+    else if ( !strcmp( call, "term_resize" ) )
+        memdrv_resize( stui_context_get_driver( 
+                         find_context( line, strtoul( ref, NULL, 10 ) )->hCtx ),
+                       a, b );
+    else if ( !strcmp( call, "set_frame_interval" ) )
+    {
+        if ( frame_interval < 0 )
+            stui_context_set_frame_interval( 
+                find_context( line, strtoul( ref, NULL, 10 ) )->hCtx, a );
+    }
+    else if ( !strcmp( call, "set_async" ) )
+        stui_context_set_async( 
+            find_context( line, strtoul( ref, NULL, 10 ) )->hCtx, a );
+    else if ( !strcmp( call, "begin_update" ) )
+        stui_context_begin_update( 
+            find_context( line, strtoul( ref, NULL, 10 ) )->hCtx );
+    else if ( !strcmp( call, "end_update" ) )
+        stui_context_end_update( 
+            find_context( line, strtoul( ref, NULL, 10 ) )->hCtx );
+    else if ( !strcmp( call, "create_window" ) )
+        create_window( line, ref, a );
+    else if ( !strcmp( call, "destroy_window" ) )
+    {
+        STUI_WINDOW_T hWnd = find_window( line, ref );
+        unsigned int cn, wn;
+        
+        stui_destroy_window( hWnd );
+        sscanf( ref, "%u:%u", &cn, &wn );
+        contexts[cn - 1].wins[wn - 1] = NULL;
+    }
+    else if ( !strcmp( call, "show_window" ) )
+        stui_show_window( find_window( line, ref ) );
+    else if ( !strcmp( call, "hide_window" ) )
+        stui_hide_window( find_window( line, ref ) );
+    else if ( !strcmp( call, "move_window" ) )
+        stui_move_window( find_window( line, ref ), a, b );
+    else if ( !strcmp( call, "resize_window" ) )
+        stui_resize_window( find_window( line, ref ), a, b );
+    else if ( !strcmp( call, "raise_window" ) )
+        stui_raise_window( find_window( line, ref ) );
+    else if ( !strcmp( call, "repaint" ) )
+        stui_repaint( find_window( line, ref ) );
+    else if ( !strcmp( call, "scroll_window" ) )
+        stui_scroll_window( find_window( line, ref ), (int)a );
+    else
+        fail( line, "unknown call" );
+}
+
+/** Total frames presented by all the contexts **/
+static unsigned long total_frames( void )
+{
+    unsigned long frames = closed_frames;
+    unsigned int i;
+    
+    for ( i = 0; i < n_contexts; i++ )
+        if ( contexts[i].hCtx )
+            frames += memdrv_get_frames( 
+                        stui_context_get_driver( contexts[i].hCtx ) );
+    
+    return frames;
+}
+
+/** Total bytes encoded for all the contexts **/
+static unsigned long total_bytes( void )
+{
+    unsigned long bytes = closed_bytes;
+    unsigned int i;
+    
+    for ( i = 0; i < n_contexts; i++ )
+        if ( contexts[i].hCtx )
+            bytes += memdrv_get_bytes( 
+                       stui_context_get_driver( contexts[i].hCtx ) );
+    
+    return bytes;
+}
+
+/*****************************************************************************/
+/* Public functions.                                                         */
+/*****************************************************************************/
+
+int main( int argc, char *argv[] )
+{
+    char buf[MAX_LINE], call[64], ref[32];
+    unsigned int line = 0, n_calls = 0;
+    unsigned int start, calls_us, last_frame_us, t, a, b, i;
+    int lines;
+    unsigned long frames, prev;
+    FILE *fp;
+    
+    for ( i = 1; i < (unsigned int)argc - 1; i++ )
+    {
+        if ( !strcmp( argv[i], "-r" ) )
+            real_time = 1;
+        else if ( !strcmp( argv[i], "-i" ) && i + 2 < (unsigned int)argc )
+            frame_interval = atoi( argv[++i] );
+        else
+            break;
+    }
+    
+    if ( argc < 2 || i != (unsigned int)argc - 1 )
+    {
+        fprintf( stderr, "usage: trace_replay [-r] [-i ms] file\n" );
+        return 1;
+    }
+    
+    fp = fopen( argv[argc - 1], "r" );
+    if ( !fp )
+    {
+        fprintf( stderr, "trace_replay: cannot open %s\n", argv[argc - 1] );
+        return 1;
+    }
+    
+    if ( osal_mutex_init( &count_lock, "count" ) )
+        return 1;
+    
+    osal_get_systime( NULL, &start );
+    
+    while ( fgets( buf, sizeof(buf), fp ) )
+    {
+        line++;
+        if ( '#' == buf[0] || '\n' == buf[0] )
+            continue;
+        
+        a = b = 0;
+        if ( sscanf( buf, "%u %63s %31s %u %u", &t, call, ref, &a, &b ) < 3 )
+            fail( line, "bad line" );
+        
+        /* Scroll amounts are signed */
+        if ( !strcmp( call, "scroll_window" ) )
+        {
+            if ( 1 != sscanf( buf, "%*u %*s %*s %d", &lines ) )
+                fail( line, "bad scroll" );
+            a = (unsigned int)lines;
+        }
+        
+        if ( real_time && t > since( start ) + 1000 )
+            osal_task_sleep( ( t - since( start ) ) / 1000 );
+        
+        run( line, call, ref, a, b );
+        n_calls++;
+    }
+    fclose( fp );
+    
+    calls_us = since( start ) - idle_us;
+    
+    /* Wait for the server to catch up */
+    last_frame_us = calls_us;
+    prev = total_frames();
+    for ( i = 0; i < IDLE_MS / POLL_MS; i++ )
+    {
+        osal_task_sleep( POLL_MS );
+        frames = total_frames();
+        if ( frames != prev )
+        {
+            last_frame_us = since( start ) - idle_us;
+            prev = frames;
+            i = 0;
+        }
+    }
+    
+    printf( "%u calls in %.3f ms, last frame at %.3f ms\n", 
+            n_calls, calls_us / 1e3, last_frame_us / 1e3 );
+    printf( "%lu frames, %lu callbacks, %lu cells painted, %lu bytes encoded\n",
+            total_frames(), callbacks, cells, total_bytes() );
+    
+    for ( i = 0; i < n_contexts; i++ )
+    {
+        if ( contexts[i].hCtx )
+            stui_context_close( contexts[i].hCtx );
+        free( contexts[i].wins );
+    }
+    free( contexts );
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
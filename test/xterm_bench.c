@@ -0,0 +1,376 @@
+/* ****************************************************************************
+ * STUI - Simple Text User Interface
+ * Copyright (C) 2018, Neil Johnson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ************************************************************************* */
+
+
+/*****************************************************************************/
+/*
+   Byte-count benchmark for the xterm encoder.
+   
+   Generates a number of representative screen sequences and reports how many
+   bytes are needed to present them:
+   
+     full    - the original driver, redrawing every cell with a full SGR
+               sequence each frame
+     cup     - only changed cells, with absolute cursor positioning
+     opt     - only changed cells, with all encoder optimisations
+   
+   Usage: xterm_bench [rows cols]
+*/
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* System Includes                                                           */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+/* Project Includes                                                          */
+/*****************************************************************************/
+
+#include "stui.h"
+#include "xterm_enc.h"
+
+/*****************************************************************************/
+/* Macros, constants                                                         */
+/*****************************************************************************/
+
+#define NUM_FRAMES      ( 100 )
+
+/*****************************************************************************/
+/* Data types                                                                */
+/*****************************************************************************/
+
+/**
+   A scenario draws frame n of its sequence into the screen buffer.
+**/
+struct scenario {
+    const char *name;
+    void (*draw)( STUI_CHAR_T *, unsigned int );
+};
+
+/*****************************************************************************/
+/* Private Data.  Declare as static.                                         */
+/*****************************************************************************/
+
+static unsigned int rows = 60, cols = 200;
+
+static const char *words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", 
+    "status", "OK", "error", "warning", "connected", "queue", "latency"
+};
+
+#define NUM_WORDS   ( sizeof(words) / sizeof(words[0]) )
+
+/*****************************************************************************/
+/* Private functions.  Declare as static.                                    */
+/*****************************************************************************/
+
+/** Encoder sink that just discards the output **/
+static void discard( void *arg, const char *buf, size_t len )
+{
+    (void)arg;
+    (void)buf;
+    (void)len;
+}
+
+/** Fill a rectangle of the screen with one character **/
+static void fill( STUI_CHAR_T *scr, unsigned int row, unsigned int col,
+                  unsigned int h, unsigned int w, STUI_CHAR_T c )
+{
+    unsigned int r, k;
+    
+    for ( r = row; r < row + h && r < rows; r++ )
+        for ( k = col; k < col + w && k < cols; k++ )
+            scr[ ( r * cols ) + k ] = c;
+}
+
+/** Write a string onto the screen, clipped to the right edge **/
+static void text( STUI_CHAR_T *scr, unsigned int row, unsigned int col,
+                  STUI_CHAR_T attr, const char *s )
+{
+    for ( ; *s && col < cols && row < rows; col++ )
+        scr[ ( row * cols ) + col ] = (unsigned char)*s++ | attr;
+}
+
+/** Draw a box with a border **/
+static void box( STUI_CHAR_T *scr, unsigned int row, unsigned int col,
+                 unsigned int h, unsigned int w )
+{
+    fill( scr, row,         col,         h, w, ' ' );
+    fill( scr, row,         col,         1, w, '-' );
+    fill( scr, row + h - 1, col,         1, w, '-' );
+    fill( scr, row,         col,         h, 1, '|' );
+    fill( scr, row,         col + w - 1, h, 1, '|' );
+}
+
+/** Write line n of a pseudo-random log into a row **/
+static void log_line( STUI_CHAR_T *scr, unsigned int row, unsigned int n )
+{
+    char buf[64];
+    unsigned int col, i;
+    
+    sprintf( buf, "%06u ", n );
+    text( scr, row, 0, 0, buf );
+    col = strlen( buf );
+    
+    for ( i = 0; col < cols; i++ )
+    {
+        const char *w = words[ ( n * 7 + i * 3 ) % NUM_WORDS ];
+        STUI_CHAR_T attr = ( w[0] == 'e' ) ? STUI_ATTR_BOLD : 0;
+        
+        if ( ( n + i ) % 5 == 0 )
+            break;
+        text( scr, row, col, attr, w );
+        col += strlen( w ) + 1;
+    }
+}
+
+/** A page of text, the same each frame apart from a clock **/
+static void draw_text( STUI_CHAR_T *scr, unsigned int n )
+{
+    unsigned int r;
+    char buf[32];
+    
+    for ( r = 0; r < rows; r++ )
+        log_line( scr, r, r );
+    
+    sprintf( buf, " %02u:%02u ", n / 60, n % 60 );
+    text( scr, 0, cols - 8, STUI_ATTR_REVERSE, buf );
+}
+
+/** A popup moving diagonally over a dotted background **/
+static void draw_popup( STUI_CHAR_T *scr, unsigned int n )
+{
+    unsigned int pos = n % ( rows > 12 ? rows - 12 : 1 );
+    
+    fill( scr, 0, 0, rows, cols, '.' );
+    box( scr, pos, pos * 2, 10, 20 );
+    text( scr, pos + 4, pos * 2 + 5, STUI_ATTR_BOLD, "hello" );
+}
+
+/** A grid of panels with numbers that change each frame **/
+static void draw_dashboard( STUI_CHAR_T *scr, unsigned int n )
+{
+    unsigned int r, c, i = 0;
+    char buf[32];
+    
+    fill( scr, 0, 0, rows, cols, ' ' );
+    for ( r = 0; r + 6 <= rows; r += 6 )
+    {
+        for ( c = 0; c + 25 <= cols; c += 25, i++ )
+        {
+            box( scr, r, c, 6, 25 );
+            text( scr, r + 1, c + 2, STUI_ATTR_BOLD, words[ i % NUM_WORDS ] );
+            
+            /* Only some of the values change each frame */
+            sprintf( buf, "%8u", ( i % 4 == n % 4 ) ? i * 31 + n : i * 31 );
+            text( scr, r + 3, c + 2, 0, buf );
+        }
+    }
+}
+
+/** A full-screen log scrolling by one line per frame **/
+static void draw_log( STUI_CHAR_T *scr, unsigned int n )
+{
+    unsigned int r;
+    
+    fill( scr, 0, 0, rows, cols, ' ' );
+    for ( r = 0; r < rows - 1; r++ )
+        log_line( scr, r, n + r );
+    
+    fill( scr, rows - 1, 0, 1, cols, ' ' | STUI_ATTR_REVERSE );
+    text( scr, rows - 1, 1, STUI_ATTR_REVERSE, "-- log --" );
+}
+
+/** A panel alternating between text and blank **/
+static void draw_clear( STUI_CHAR_T *scr, unsigned int n )
+{
+    unsigned int r;
+    
+    fill( scr, 0, 0, rows, cols, ' ' );
+    if ( n & 1 )
+        for ( r = 2; r < rows - 2; r++ )
+            log_line( scr, r, r * 3 );
+}
+
+static const struct scenario scenarios[] = {
+    { "text",      draw_text      },
+    { "popup",     draw_popup     },
+    { "dashboard", draw_dashboard },
+    { "log",       draw_log       },
+    { "clear",     draw_clear     }
+};
+
+#define NUM_SCENARIOS   ( sizeof(scenarios) / sizeof(scenarios[0]) )
+
+/** Bytes the original driver sent to redraw the entire screen **/
+static unsigned long full_bytes( const STUI_CHAR_T *scr )
+{
+    unsigned long bytes = 6; /* ESC [ 1 ; 1 H */
+    unsigned int i;
+    
+    for ( i = 0; i < rows * cols; i++ )
+    {
+        /* ESC [ 0 {;n} m c */
+        bytes += 5;
+        if ( scr[i] & STUI_ATTR_BOLD )    bytes += 2;
+        if ( scr[i] & STUI_ATTR_BLINK )   bytes += 2;
+        if ( scr[i] & STUI_ATTR_REVERSE ) bytes += 2;
+        if ( scr[i] & STUI_ATTR_UNDLINE ) bytes += 2;
+    }
+    
+    return bytes;
+}
+
+/** Find the runs of changed cells, as the server does **/
+static unsigned int diff( STUI_CHAR_T *back, STUI_CHAR_T *front, 
+                          struct drv_run *runs )
+{
+    unsigned int row, col, start, n = 0;
+    
+    for ( row = 0; row < rows; row++ )
+    {
+        for ( col = 0; col < cols; )
+        {
+            unsigned int i = ( row * cols ) + col;
+            
+            if ( back[i] == front[i] )
+            {
+                col++;
+                continue;
+            }
+            
+            start = col;
+            for ( ; col < cols && back[i] != front[i]; col++, i++ )
+                front[i] = back[i];
+            
+            runs[n].row = row;
+            runs[n].col = start;
+            runs[n].len = col - start;
+            n++;
+        }
+    }
+    
+    return n;
+}
+
+/** Run a scenario with the given encoder options, returning the byte count **/
+static unsigned long run( const struct scenario *sc, unsigned int opts )
+{
+    struct xterm_enc enc;
+    STUI_CHAR_T *back, *front;
+    struct drv_run *runs;
+    unsigned long bytes;
+    unsigned int n;
+    
+    back  = calloc( rows * cols, sizeof(STUI_CHAR_T) );
+    front = calloc( rows * cols, sizeof(STUI_CHAR_T) );
+    runs  = calloc( rows * ( ( cols + 1 ) / 2 ), sizeof(struct drv_run) );
+    if ( !back || !front || !runs || xenc_init( &enc, discard, NULL ) )
+    {
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+    
+    xenc_set_size( &enc, rows, cols );
+    enc.opts = opts;
+    
+    memset( front, 0xFF, rows * cols * sizeof(STUI_CHAR_T) );
+    for ( n = 0; n < NUM_FRAMES; n++ )
+    {
+        sc->draw( back, n );
+        xenc_put_runs( &enc, back, runs, diff( back, front, runs ) );
+        xenc_flush( &enc );
+    }
+    
+    bytes = enc.bytes;
+    xenc_free( &enc );
+    free( back );
+    free( front );
+    free( runs );
+    
+    return bytes;
+}
+
+/*****************************************************************************/
+/* Public functions.                                                         */
+/*****************************************************************************/
+
+int main( int argc, char *argv[] )
+{
+    unsigned int i, n;
+    
+    if ( argc == 3 )
+    {
+        rows = atoi( argv[1] );
+        cols = atoi( argv[2] );
+    }
+    
+    if ( rows < 16 || cols < 30 )
+    {
+        fprintf( stderr, "screen must be at least 16 x 30\n" );
+        return 1;
+    }
+    
+    printf( "%u frames of %u x %u\n\n", NUM_FRAMES, rows, cols );
+    printf( "%-10s %12s %12s %12s %8s\n", "scenario", "full", "cup", "opt", "full/opt" );
+    
+    for ( i = 0; i < NUM_SCENARIOS; i++ )
+    {
+        STUI_CHAR_T *scr = calloc( rows * cols, sizeof(STUI_CHAR_T) );
+        unsigned long full = 0, cup, opt;
+        
+        if ( !scr )
+            return 1;
+        
+        for ( n = 0; n < NUM_FRAMES; n++ )
+        {
+            scenarios[i].draw( scr, n );
+            full += full_bytes( scr );
+        }
+        free( scr );
+        
+        cup = run( &scenarios[i], 0 );
+        opt = run( &scenarios[i], XENC_OPT_ALL );
+        
+        printf( "%-10s %12lu %12lu %12lu %8.1f\n", 
+                scenarios[i].name, full, cup, opt, (double)full / opt );
+    }
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/